@@ -19,6 +19,7 @@
 #include <fstream>
 #include <iostream>
 #include <istream>
+#include <sstream>
 #include <vector>
 
 #include "position.h"
@@ -94,6 +95,71 @@ const vector<string> Defaults = {
 
 namespace Stockfish {
 
+/// read_positions() appends to fens the positions of a file with one position
+/// per line, in FEN or EPD format. Empty lines are skipped. Returns false if
+/// the file cannot be opened.
+
+bool read_positions(const string& fileName, vector<string>& fens) {
+
+  string fen;
+  ifstream file(fileName);
+
+  if (!file.is_open())
+      return false;
+
+  while (getline(file, fen))
+      if (!fen.empty())
+          fens.push_back(fen);
+
+  return true;
+}
+
+
+/// epd_id() returns the value of the 'id' operation of an EPD record, if any.
+/// Operations are separated by ';', except within a quoted operand, and the
+/// first one follows the four position fields and any FEN move counters.
+
+string epd_id(const string& epd) {
+
+  vector<string> ops(1);
+  bool quoted = false;
+
+  for (char c : epd)
+      if (c == ';' && !quoted)
+          ops.emplace_back();
+      else
+      {
+          quoted ^= (c == '"');
+          ops.back() += c;
+      }
+
+  for (size_t i = 0; i < ops.size(); ++i)
+  {
+      istringstream ss(ops[i]);
+      string opcode, value;
+      int fields = i == 0 ? 4 : 0;
+
+      while (ss >> opcode && (fields-- > 0 || (i == 0 && isdigit(opcode[0])))) {}
+
+      if (!ss || opcode != "id")
+          continue;
+
+      getline(ss >> ws, value);
+      value.erase(value.find_last_not_of(' ') + 1);
+
+      if (!value.empty() && value.back() == '"')
+          value.pop_back();
+
+      if (!value.empty() && value.front() == '"')
+          value.erase(0, 1);
+
+      return value;
+  }
+
+  return "";
+}
+
+
 /// setup_bench() builds a list of UCI commands to be run by bench. There
 /// are five parameters: TT size in MB, number of search threads that
 /// should be used, the limit value spent for each position, a file name
@@ -128,22 +194,10 @@ vector<string> setup_bench(const Position& current, istream& is) {
   else if (fenFile == "current")
       fens.push_back(current.fen());
 
-  else
+  else if (!read_positions(fenFile, fens))
   {
-      string fen;
-      ifstream file(fenFile);
-
-      if (!file.is_open())
-      {
-          cerr << "Unable to open file " << fenFile << endl;
-          exit(EXIT_FAILURE);
-      }
-
-      while (getline(file, fen))
-          if (!fen.empty())
-              fens.push_back(fen);
-
-      file.close();
+      cerr << "Unable to open file " << fenFile << endl;
+      exit(EXIT_FAILURE);
   }
 
   list.emplace_back("setoption name Threads value " + threads);
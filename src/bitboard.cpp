@@ -36,6 +36,10 @@ Bitboard PawnAttacks[COLOR_NB][SQUARE_NB];
 Magic RookMagics[SQUARE_NB];
 Magic BishopMagics[SQUARE_NB];
 
+#if defined(USE_DISPATCH) && defined(IS_64BIT)
+const bool HasPext = cpu_has_fast_pext();
+#endif
+
 namespace {
 
   Bitboard RookTable[0x19000];  // To store rook attacks
@@ -0,0 +1,129 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2021 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <atomic>
+#include <mutex>
+
+#include "bitboard.h"
+#include "endgame.h"
+#include "engine.h"
+#include "evaluate.h"
+#include "psqt.h"
+
+namespace Stockfish {
+
+namespace {
+
+  // Number of engines alive, and lock held while creating or destroying one,
+  // as they may update data shared with the other engines.
+  std::atomic<int> EngineCount;
+  std::mutex EngineMutex;
+
+} // namespace
+
+
+/// Engine::init() initializes the data shared by all the engines of the process.
+/// It is called once at startup, before creating any engine.
+
+void Engine::init(int argc, char* argv[]) {
+
+  CommandLine::init(argc, argv);
+  PSQT::init();
+  Bitboards::init();
+  Position::init();
+  Bitbases::init();
+  Endgames::init();
+  Search::init();
+}
+
+
+/// Engine::count() returns the number of engines alive in the process
+
+int Engine::count() {
+
+  return EngineCount;
+}
+
+
+/// Engine::set_shared_option() changes an option that sets data shared by all
+/// the engines of the process, as the net or the tablebases. The change is
+/// refused while other engines exist, since they may be using that data.
+
+bool Engine::set_shared_option(UCI::Option& o, const std::string& value) {
+
+  std::lock_guard<std::mutex> lk(EngineMutex);
+
+  if (EngineCount > 1)
+      return false;
+
+  o = value;
+  return true;
+}
+
+
+/// Engine constructor sets up the options with their default values, then the
+/// threads and the hash, and loads the network unless already loaded by another
+/// engine. UCI output goes to std::cout, or to onLine if given.
+
+Engine::Engine(std::function<void(const std::string&)> onLine)
+  : lineBuf(onLine), lineStream(&lineBuf), out(onLine ? lineStream : std::cout),
+    tt(*this), threads(*this), time(*this) {
+
+  std::lock_guard<std::mutex> lk(EngineMutex);
+
+  ++EngineCount;
+
+  UCI::init(*this);
+  threads.set(size_t(options["Threads"]));
+  Search::clear(*this); // After threads are up
+  Eval::NNUE::init(*this);
+
+  UCI::execute(*this, "position startpos");
+}
+
+
+/// Engine destructor stops the search and releases the threads
+
+Engine::~Engine() {
+
+  std::lock_guard<std::mutex> lk(EngineMutex);
+
+  threads.stop = true;
+  threads.set(0);
+
+  --EngineCount;
+}
+
+
+/// Engine::LineBuf::overflow() collects the characters written to the stream,
+/// and passes on each line when complete.
+
+int Engine::LineBuf::overflow(int c) {
+
+  if (c == '\n')
+  {
+      onLine(line);
+      line.clear();
+  }
+  else if (c != traits_type::eof())
+      line += char(c);
+
+  return traits_type::not_eof(c);
+}
+
+} // namespace Stockfish
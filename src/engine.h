@@ -0,0 +1,86 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2021 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef ENGINE_H_INCLUDED
+#define ENGINE_H_INCLUDED
+
+#include <functional>
+#include <ostream>
+#include <streambuf>
+#include <string>
+
+#include "position.h"
+#include "search.h"
+#include "thread.h"
+#include "timeman.h"
+#include "tt.h"
+#include "uci.h"
+#include "syzygy/tbprobe.h"
+
+namespace Stockfish {
+
+/// Engine class holds the state of an independent engine instance: its UCI
+/// options, search threads, transposition table, search limits and time
+/// management, and the position of the last 'position' command. Several
+/// engines can live and search at the same time in one process. They share
+/// the read-only data set up once by Engine::init() and the network loaded
+/// by the first engine: bitboards, endgames, NNUE weights and tablebases.
+/// The UCI executable runs a single engine, the C interface of libstockfish.h
+/// any number of them.
+
+class Engine {
+
+  // LineBuf passes each complete line written to it to a callback
+  class LineBuf : public std::streambuf {
+  public:
+    explicit LineBuf(std::function<void(const std::string&)> f) : onLine(std::move(f)) {}
+
+  private:
+    int overflow(int c) override;
+
+    std::function<void(const std::string&)> onLine;
+    std::string line;
+  };
+
+  LineBuf lineBuf;
+  std::ostream lineStream;
+
+public:
+  static void init(int argc, char* argv[]);
+  static int count();
+  static bool set_shared_option(UCI::Option& o, const std::string& value);
+
+  explicit Engine(std::function<void(const std::string&)> onLine = nullptr);
+ ~Engine();
+
+  std::ostream& out; // std::cout, or line by line to the callback given at creation
+  UCI::OptionsMap options;
+  TranspositionTable tt;
+  ThreadPool threads;
+  Search::LimitsType limits;
+  TimeManagement time;
+  Tablebases::Config tbConfig;
+
+  Position pos;
+  StateListPtr states;
+};
+
+} // namespace Stockfish
+
+#endif // #ifndef ENGINE_H_INCLUDED
@@ -28,6 +28,7 @@
 #include <vector>
 
 #include "bitboard.h"
+#include "engine.h"
 #include "evaluate.h"
 #include "material.h"
 #include "misc.h"
@@ -70,14 +71,16 @@ namespace Eval {
   /// network may be embedded in the binary), in the active working directory and
   /// in the engine directory. Distro packagers may define the DEFAULT_NNUE_DIRECTORY
   /// variable to have the engine search in a special directory in their distro.
+  /// The network is shared by all the engines of the process, and a network file
+  /// exported with 'export_net mapped' is shared by all the processes using it.
 
-  void NNUE::init() {
+  void NNUE::init(Engine& engine) {
 
-    useNNUE = Options["Use NNUE"];
+    useNNUE = engine.options["Use NNUE"];
     if (!useNNUE)
         return;
 
-    string eval_file = string(Options["EvalFile"]);
+    string eval_file = string(engine.options["EvalFile"]);
 
     #if defined(DEFAULT_NNUE_DIRECTORY)
     #define stringify2(x) #x
@@ -92,9 +95,15 @@ namespace Eval {
         {
             if (directory != "<internal>")
             {
-                ifstream stream(directory + eval_file, ios::binary);
-                if (load_eval(eval_file, stream))
+                // A net exported in the mapped format is used in place
+                if (map_eval(eval_file, directory + eval_file))
                     eval_file_loaded = eval_file;
+                else
+                {
+                    ifstream stream(directory + eval_file, ios::binary);
+                    if (load_eval(eval_file, stream, engine.out))
+                        eval_file_loaded = eval_file;
+                }
             }
 
             if (directory == "<internal>" && eval_file == EvalFileDefaultName)
@@ -108,42 +117,141 @@ namespace Eval {
                                     size_t(gEmbeddedNNUESize));
 
                 istream stream(&buffer);
-                if (load_eval(eval_file, stream))
+                if (load_eval(eval_file, stream, engine.out))
                     eval_file_loaded = eval_file;
             }
         }
   }
 
   /// NNUE::verify() verifies that the last net used was loaded successfully
-  void NNUE::verify() {
+  void NNUE::verify(Engine& engine) {
 
-    string eval_file = string(Options["EvalFile"]);
+    string eval_file = string(engine.options["EvalFile"]);
 
     if (useNNUE && eval_file_loaded != eval_file)
     {
-        UCI::OptionsMap defaults;
-        UCI::init(defaults);
-
         string msg1 = "If the UCI option \"Use NNUE\" is set to true, network evaluation parameters compatible with the engine must be available.";
         string msg2 = "The option is set to true, but the network file " + eval_file + " was not loaded successfully.";
         string msg3 = "The UCI option EvalFile might need to specify the full path, including the directory name, to the network file.";
-        string msg4 = "The default net can be downloaded from: https://tests.stockfishchess.org/api/nn/" + string(defaults["EvalFile"]);
+        string msg4 = "The default net can be downloaded from: https://tests.stockfishchess.org/api/nn/" + string(EvalFileDefaultName);
         string msg5 = "The engine will be terminated now.";
 
-        sync_cout << "info string ERROR: " << msg1 << sync_endl;
-        sync_cout << "info string ERROR: " << msg2 << sync_endl;
-        sync_cout << "info string ERROR: " << msg3 << sync_endl;
-        sync_cout << "info string ERROR: " << msg4 << sync_endl;
-        sync_cout << "info string ERROR: " << msg5 << sync_endl;
+        engine.out << IO_LOCK << "info string ERROR: " << msg1 << sync_endl;
+        engine.out << IO_LOCK << "info string ERROR: " << msg2 << sync_endl;
+        engine.out << IO_LOCK << "info string ERROR: " << msg3 << sync_endl;
+        engine.out << IO_LOCK << "info string ERROR: " << msg4 << sync_endl;
+        engine.out << IO_LOCK << "info string ERROR: " << msg5 << sync_endl;
 
         exit(EXIT_FAILURE);
     }
 
     if (useNNUE)
-        sync_cout << "info string NNUE evaluation using " << eval_file << " enabled" << sync_endl;
+        engine.out << IO_LOCK << "info string NNUE evaluation using " << eval_file << " enabled" << sync_endl;
     else
-        sync_cout << "info string classical evaluation enabled" << sync_endl;
+        engine.out << IO_LOCK << "info string classical evaluation enabled" << sync_endl;
+  }
+
+#if defined(NNUE_STATS)
+
+  thread_local NNUE::NnueStats* NNUE::NnueStats::local = nullptr;
+  const char* NNUE::NnueStats::names[NNUE::StageNb];
+
+  /// NNUE::NnueStats::report() returns a table of the time spent in each stage
+  /// of the NNUE evaluation, exclusive of the stages it calls.
+
+  string NNUE::NnueStats::report() const {
+
+    const string unit = NNUE_STATS_UNIT;
+    uint64_t total = 0;
+
+    for (int s = 0; s < StageNb; ++s)
+        total += cycles[s];
+
+    stringstream ss;
+    ss << fixed << setprecision(1)
+       << left << setw(40) << "Stage" << right << setw(14) << "Calls"
+       << setw(18) << unit + "/call" << setw(10) << "Share" << "\n";
+
+    for (int s = 0; s < StageNb; ++s)
+    {
+        if (!calls[s])
+            continue;
+
+        string name = s < StageLayers ? string(names[s])
+                    : "Layer " + to_string(s - StageLayers + 1) + " " + names[s];
+
+        ss << left << setw(40) << name << right << setw(14) << calls[s]
+           << setw(18) << double(cycles[s]) / calls[s]
+           << setw(9) << 100.0 * cycles[s] / max(total, uint64_t(1)) << "%\n";
+    }
+
+    ss << "Total " << unit << "      : " << total;
+
+    return ss.str();
+  }
+
+#endif
+
+  /// NNUE::stats() returns the time spent in each stage of the NNUE evaluation
+  /// by all the search threads since the last ucinewgame.
+
+  string NNUE::stats(Engine& engine) {
+
+#if defined(NNUE_STATS)
+    NnueStats total {};
+
+    for (Thread* th : engine.threads)
+        for (int s = 0; s < StageNb; ++s)
+        {
+            total.cycles[s] += th->nnueStats.cycles[s];
+            total.calls[s]  += th->nnueStats.calls[s];
+        }
+
+    return total.report();
+#else
+    (void)engine;
+    return "NNUE statistics are not available, build with nnuestats=yes";
+#endif
   }
+
+#if defined(USE_DISPATCH)
+
+  // The NNUE code of a dispatch build is compiled once for each instruction set
+  // level, in nnue/evaluate_nnue.cpp. The variant matching the CPU is selected
+  // at startup, and the network is only loaded into it.
+
+  namespace NNUE {
+
+    namespace sse2    { extern const Kernels kernels; }
+    namespace sse41   { extern const Kernels kernels; }
+    namespace avx2    { extern const Kernels kernels; }
+    namespace avx512  { extern const Kernels kernels; }
+    namespace vnni512 { extern const Kernels kernels; }
+
+    const Kernels* Variants[CPU_LEVEL_NB] = {
+      &sse2::kernels, &sse41::kernels, &avx2::kernels, &avx512::kernels, &vnni512::kernels
+    };
+
+    const Kernels& Active = *Variants[cpu_level()];
+  }
+
+  Value NNUE::evaluate(const Position& pos, bool adjusted) { return Active.evaluate(pos, adjusted); }
+  Value NNUE::evaluate_psqt(const Position& pos) { return Active.evaluate_psqt(pos); }
+  void NNUE::evaluate_batch(const Position* const positions[], size_t count, Value values[], bool adjusted) {
+    Active.evaluate_batch(positions, count, values, adjusted);
+  }
+  void NNUE::prefetch_weights(const Position& pos) {
+    Active.prefetch_weights(pos);
+  }
+  uint32_t NNUE::transformed_width() { return Active.transformed_width(); }
+  string NNUE::trace(Position& pos) { return Active.trace(pos); }
+  bool NNUE::load_eval(string name, istream& stream, ostream& out) { return Active.load_eval(name, stream, out); }
+  bool NNUE::map_eval(string name, const string& path) { return Active.map_eval(name, path); }
+  bool NNUE::save_eval(ostream& stream, bool compressed) { return Active.save_eval(stream, compressed); }
+  bool NNUE::save_eval(const optional<string>& filename, ostream& out, bool compressed) { return Active.save_eval_file(filename, out, compressed); }
+  bool NNUE::save_eval_mapped(const string& filename, ostream& out) { return Active.save_eval_mapped(filename, out); }
+
+#endif
 }
 
 namespace Trace {
@@ -1073,6 +1181,15 @@ make_v:
                                        : -Value(correction);
   }
 
+  // Scale of the NNUE output for compatibility with search and classical
+  // evaluation, which grows with the material on the board
+  int nnue_scale(const Position& pos) {
+
+    return   903
+           + 32 * pos.count<PAWN>()
+           + 32 * pos.non_pawn_material() / 1024;
+  }
+
 } // namespace Eval
 
 
@@ -1090,11 +1207,7 @@ Value Eval::evaluate(const Position& pos) {
       // Scale and shift NNUE for compatibility with search and classical evaluation
       auto  adjusted_NNUE = [&]()
       {
-         int scale =   903
-                     + 32 * pos.count<PAWN>()
-                     + 32 * pos.non_pawn_material() / 1024;
-
-         Value nnue = NNUE::evaluate(pos, true) * scale / 1024;
+         Value nnue = NNUE::evaluate(pos, true) * nnue_scale(pos) / 1024;
 
          if (pos.is_chess960())
              nnue += fix_FRC(pos);
@@ -1121,6 +1234,28 @@ Value Eval::evaluate(const Position& pos) {
   return v;
 }
 
+
+/// evaluate_psqt() is a cheap estimate of evaluate() from the PSQT part of the
+/// NNUE, the material term of the net, for pruning decisions that do not need
+/// the full evaluation. It updates the accumulators, but skips the layers of
+/// the net, and does not use the classical evaluation. Returns VALUE_NONE when
+/// the NNUE is not used.
+
+Value Eval::evaluate_psqt(const Position& pos) {
+
+  if (!Eval::useNNUE)
+      return VALUE_NONE;
+
+  Value v = NNUE::evaluate_psqt(pos) * nnue_scale(pos) / 1024;
+
+  if (pos.is_chess960())
+      v += fix_FRC(pos);
+
+  v = v * (100 - pos.rule50_count()) / 100;
+
+  return std::clamp(v, VALUE_TB_LOSS_IN_MAX_PLY + 1, VALUE_TB_WIN_IN_MAX_PLY - 1);
+}
+
 /// trace() is like evaluate(), but instead of returning a value, it returns
 /// a string (suitable for outputting to stdout) that contains the detailed
 /// descriptions and values of each evaluation term. Useful for debugging.
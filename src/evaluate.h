@@ -26,12 +26,14 @@
 
 namespace Stockfish {
 
+class Engine;
 class Position;
 
 namespace Eval {
 
   std::string trace(Position& pos);
   Value evaluate(const Position& pos);
+  Value evaluate_psqt(const Position& pos);
 
   extern bool useNNUE;
   extern std::string eval_file_loaded;
@@ -45,13 +47,38 @@ namespace Eval {
 
     std::string trace(Position& pos);
     Value evaluate(const Position& pos, bool adjusted = false);
-
-    void init();
-    void verify();
-
-    bool load_eval(std::string name, std::istream& stream);
-    bool save_eval(std::ostream& stream);
-    bool save_eval(const std::optional<std::string>& filename);
+    Value evaluate_psqt(const Position& pos);
+    void evaluate_batch(const Position* const positions[], std::size_t count,
+                        Value values[], bool adjusted = false);
+    void prefetch_weights(const Position& pos);
+    std::uint32_t transformed_width();
+
+    void init(Engine& engine);
+    void verify(Engine& engine);
+    std::string stats(Engine& engine);
+
+    bool load_eval(std::string name, std::istream& stream, std::ostream& out);
+    bool map_eval(std::string name, const std::string& path);
+    bool save_eval(std::ostream& stream, bool compressed = false);
+    bool save_eval(const std::optional<std::string>& filename, std::ostream& out, bool compressed = false);
+    bool save_eval_mapped(const std::string& filename, std::ostream& out);
+
+#if defined(USE_DISPATCH)
+    // Entry points of the NNUE code compiled for one instruction set level
+    struct Kernels {
+      Value (*evaluate)(const Position&, bool);
+      Value (*evaluate_psqt)(const Position&);
+      void (*evaluate_batch)(const Position* const[], std::size_t, Value[], bool);
+      void (*prefetch_weights)(const Position&);
+      std::uint32_t (*transformed_width)();
+      std::string (*trace)(Position&);
+      bool (*load_eval)(std::string, std::istream&, std::ostream&);
+      bool (*map_eval)(std::string, const std::string&);
+      bool (*save_eval)(std::ostream&, bool);
+      bool (*save_eval_file)(const std::optional<std::string>&, std::ostream&, bool);
+      bool (*save_eval_mapped)(const std::string&, std::ostream&);
+    };
+#endif
 
   } // namespace NNUE
 
@@ -0,0 +1,83 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2021 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "engine.h"
+#include "libstockfish.h"
+
+using namespace Stockfish;
+
+struct sf_engine {
+  explicit sf_engine(std::function<void(const std::string&)> f) : engine(std::move(f)) {}
+  Engine engine;
+};
+
+
+/// sf_init() initializes the data shared by the engines. It is called once,
+/// before creating any engine. The arguments locate the directory of the
+/// program, where the network file is searched, and may be 0 and NULL.
+
+void sf_init(int argc, char* argv[]) {
+
+  static char empty[] = "";
+  static char* noArgs[] = { empty, nullptr };
+
+  Engine::init(argc ? argc : 1, argc ? argv : noArgs);
+}
+
+
+/// sf_engine_new() creates an engine, set up as after 'ucinewgame' and
+/// 'position startpos'. Output lines, without the newline, are passed to the
+/// given function together with data. If the function is NULL, the output is
+/// discarded.
+
+sf_engine* sf_engine_new(sf_output_fn output, void* data) {
+
+  if (!output)
+      return new sf_engine([](const std::string&) {});
+
+  return new sf_engine([=](const std::string& line) { output(line.c_str(), data); });
+}
+
+
+/// sf_engine_delete() stops the search of the engine, if any, and frees it
+
+void sf_engine_delete(sf_engine* e) {
+
+  delete e;
+}
+
+
+/// sf_engine_command() executes a UCI command, or one of the debug commands of
+/// the executable. Like 'go', the commands that start a search return at once.
+/// Returns 0 after 'quit', otherwise 1.
+
+int sf_engine_command(sf_engine* e, const char* cmd) {
+
+  return UCI::execute(e->engine, cmd);
+}
+
+
+/// sf_engine_wait() blocks until the search started by the last 'go' of the
+/// engine is done, including the 'bestmove' output.
+
+void sf_engine_wait(sf_engine* e) {
+
+  e->engine.threads.main()->wait_for_search_finished();
+  e->engine.threads.wait_for_jobs_finished();
+}
@@ -0,0 +1,63 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2021 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/// libstockfish.h is the C interface of the static library built with 'make
+/// library'. It runs any number of independent engines in the host process,
+/// each one driven by UCI commands as text, with its output passed back line
+/// by line to a callback.
+///
+///   sf_init(argc, argv);
+///   sf_engine* e = sf_engine_new(print_line, NULL);
+///   sf_engine_command(e, "position startpos moves e2e4");
+///   sf_engine_command(e, "go depth 20");
+///   sf_engine_wait(e);
+///   sf_engine_delete(e);
+///
+/// Engines have their own options, threads and hash, and can search at the
+/// same time. The data set by the options Debug Log File, Huge Pages,
+/// SyzygyPath, Use NNUE and EvalFile is instead shared by all the engines:
+/// in particular the network and Use NNUE apply to every engine of the
+/// process. Huge Pages, SyzygyPath, Use NNUE and EvalFile can only be changed
+/// while a single engine exists, otherwise the change is refused with an
+/// 'info string'. An engine created next to others starts with their net. The callback
+/// is called from the engine threads while holding the output lock of the
+/// process: it should copy or queue the line and return, without sending
+/// commands to any engine. A NULL callback discards the output of the engine.
+
+#ifndef LIBSTOCKFISH_H_INCLUDED
+#define LIBSTOCKFISH_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct sf_engine sf_engine;
+typedef void (*sf_output_fn)(const char* line, void* data);
+
+void sf_init(int argc, char* argv[]);
+sf_engine* sf_engine_new(sf_output_fn output, void* data);
+void sf_engine_delete(sf_engine* engine);
+int sf_engine_command(sf_engine* engine, const char* cmd);
+void sf_engine_wait(sf_engine* engine);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // #ifndef LIBSTOCKFISH_H_INCLUDED
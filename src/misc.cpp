@@ -42,13 +42,20 @@ typedef bool(*fun3_t)(HANDLE, CONST GROUP_AFFINITY*, PGROUP_AFFINITY);
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <map>
 #include <sstream>
 #include <vector>
 #include <cstdlib>
 
 #if defined(__linux__) && !defined(__ANDROID__)
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #endif
 
 #if defined(__APPLE__) || defined(__ANDROID__) || defined(__OpenBSD__) || (defined(__GLIBCXX__) && !defined(_GLIBCXX_HAVE_ALIGNED_ALLOC) && !defined(_WIN32)) || defined(__e2k__)
@@ -56,6 +63,10 @@ typedef bool(*fun3_t)(HANDLE, CONST GROUP_AFFINITY*, PGROUP_AFFINITY);
 #include <stdlib.h>
 #endif
 
+#if defined(USE_DISPATCH)
+#include <cpuid.h>
+#endif
+
 #include "misc.h"
 #include "thread.h"
 
@@ -240,7 +251,9 @@ std::string compiler_info() {
   #if defined(USE_AVX512)
     compiler += " AVX512";
   #endif
-  compiler += (HasPext ? " BMI2" : "");
+  #if !defined(USE_DISPATCH)
+    compiler += (HasPext ? " BMI2" : "");
+  #endif
   #if defined(USE_AVX2)
     compiler += " AVX2";
   #endif
@@ -265,6 +278,13 @@ std::string compiler_info() {
     compiler += " DEBUG";
   #endif
 
+  #if defined(USE_DISPATCH)
+    const char* levels[] = { "SSE2", "SSE41", "AVX2", "AVX512", "VNNI512" };
+    compiler += "\nSelected at startup for this CPU: NNUE ";
+    compiler += levels[cpu_level()];
+    compiler += (HasPext ? ", BMI2" : "");
+  #endif
+
   compiler += "\n__VERSION__ macro expands to: ";
   #ifdef __VERSION__
      compiler += __VERSION__;
@@ -277,6 +297,56 @@ std::string compiler_info() {
 }
 
 
+#if defined(USE_DISPATCH)
+
+/// cpu_level() returns the highest level of the NNUE code that the CPU can run.
+/// __builtin_cpu_supports() also checks that the OS saves the AVX registers.
+
+CpuLevel cpu_level() {
+
+  __builtin_cpu_init(); // May be called before the constructors of main()
+
+  if (   __builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512bw")
+      && __builtin_cpu_supports("avx512dq")   && __builtin_cpu_supports("avx512vl"))
+      return CPU_VNNI512;
+
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+      return CPU_AVX512;
+
+  if (__builtin_cpu_supports("avx2"))
+      return CPU_AVX2;
+
+  if (__builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("ssse3"))
+      return CPU_SSE41;
+
+  return CPU_SSE2;
+}
+
+
+/// cpu_has_fast_pext() tells whether pext should be used for the bitboards.
+/// AMD processors before Zen 3 (family 19h) run it in microcode, much slower
+/// than the magic multiplication.
+
+bool cpu_has_fast_pext() {
+
+  __builtin_cpu_init();
+
+  if (!__builtin_cpu_supports("bmi2"))
+      return false;
+
+  unsigned eax = 0, ebx, ecx, edx, family;
+
+  __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+  family = (eax >> 8) & 0xF;
+  if (family == 0xF)
+      family += (eax >> 20) & 0xFF;
+
+  return !__builtin_cpu_is("amd") || family >= 0x19;
+}
+
+#endif
+
+
 /// Debug functions used mainly to collect run-time statistics
 static std::atomic<int64_t> hits[2], means[2];
 
@@ -440,8 +510,63 @@ void* aligned_large_pages_alloc(size_t allocSize) {
 
 #else
 
+namespace {
+
+  // Largest explicit huge page size to use, 0 to rely on transparent huge pages
+  size_t hugePageSize = 0;
+
+  // Memory mapped from hugetlbfs, with the mapping size and page size of each block
+  std::map<void*, std::pair<size_t, size_t>> hugePageBlocks;
+  std::mutex hugePageMutex;
+}
+
+#if defined(__linux__) && defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+
+/// aligned_huge_pages_alloc() maps memory backed by explicit huge pages from
+/// the kernel pool (see /proc/sys/vm/nr_hugepages and, for 1GB pages,
+/// /sys/kernel/mm/hugepages). Page sizes larger than the allocation are not
+/// tried, and if a page size is not available the next smaller one is tried,
+/// down to 2MB. Returns nullptr if no huge pages could be obtained.
+
+static void* aligned_huge_pages_alloc(size_t allocSize) {
+
+  for (int pageShift : { 30, 21 })
+  {
+      const size_t pageSize = size_t(1) << pageShift;
+
+      // Skip the page sizes not requested, and 1GB pages for smaller allocations
+      if (pageSize > hugePageSize || (pageShift == 30 && allocSize < pageSize))
+          continue;
+
+      const size_t size = ((allocSize + pageSize - 1) / pageSize) * pageSize;
+
+      void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (pageShift << MAP_HUGE_SHIFT), -1, 0);
+
+      if (mem != MAP_FAILED)
+      {
+          std::lock_guard<std::mutex> lk(hugePageMutex);
+          hugePageBlocks[mem] = { size, pageSize };
+          return mem;
+      }
+  }
+
+  return nullptr;
+}
+
+#else
+
+static void* aligned_huge_pages_alloc(size_t) { return nullptr; }
+
+#endif
+
 void* aligned_large_pages_alloc(size_t allocSize) {
 
+  // Try explicit huge pages first, if requested
+  if (hugePageSize)
+      if (void* mem = aligned_huge_pages_alloc(allocSize))
+          return mem;
+
 #if defined(__linux__)
   constexpr size_t alignment = 2 * 1024 * 1024; // assumed 2MB page size
 #else
@@ -479,17 +604,328 @@ void aligned_large_pages_free(void* mem) {
 #else
 
 void aligned_large_pages_free(void *mem) {
+
+  {
+      std::lock_guard<std::mutex> lk(hugePageMutex);
+      auto it = hugePageBlocks.find(mem);
+
+      if (it != hugePageBlocks.end())
+      {
+          munmap(mem, it->second.first);
+          hugePageBlocks.erase(it);
+          return;
+      }
+  }
+
   std_aligned_free(mem);
 }
 
 #endif
 
 
+/// set_huge_page_size() sets the largest explicit huge page size used by
+/// aligned_large_pages_alloc() for the following allocations. With 0, the
+/// default, we only advise the kernel to use transparent huge pages.
+/// huge_pages_report() tells which page size was actually obtained for a block
+/// allocated by aligned_large_pages_alloc(), when explicit huge pages were
+/// requested. Windows uses large pages whenever it can and ignores this.
+
+#if defined(_WIN32)
+
+void set_huge_page_size(size_t) {}
+void huge_pages_report(std::ostream&, const std::string&, void*) {}
+
+#else
+
+void set_huge_page_size(size_t size) { hugePageSize = size; }
+
+void huge_pages_report(std::ostream& out, const std::string& what, void* mem) {
+
+  if (!hugePageSize || !mem)
+      return;
+
+  size_t pageSize = 0;
+
+  {
+      std::lock_guard<std::mutex> lk(hugePageMutex);
+      auto it = hugePageBlocks.find(mem);
+
+      if (it != hugePageBlocks.end())
+          pageSize = it->second.second;
+  }
+
+  if (pageSize)
+      out << IO_LOCK << "info string " << what << " uses "
+          << (pageSize >= (size_t(1) << 30) ? std::to_string(pageSize >> 30) + "GB"
+                                            : std::to_string(pageSize >> 20) + "MB")
+          << " huge pages" << sync_endl;
+  else
+      out << IO_LOCK << "info string " << what << " could not get explicit huge pages, "
+          << "using transparent huge pages if enabled" << sync_endl;
+}
+
+#endif
+
+
+/// shared_memory_alloc() maps a named POSIX shared memory segment of the given
+/// size, creating it if it does not exist yet, so that several processes can
+/// work on the same memory. A new segment is zero filled by the OS. Returns
+/// nullptr if shared memory is not supported or if the segment already exists
+/// with a different size. The segment persists until it is removed from
+/// /dev/shm, so its content survives the processes using it.
+
+#if defined(__linux__) && !defined(__ANDROID__)
+
+void* shared_memory_alloc(const std::string& name, size_t size) {
+
+  const std::string shmName = name[0] == '/' ? name : "/" + name;
+  bool created = true;
+
+  int fd = shm_open(shmName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd == -1 && errno == EEXIST)
+  {
+      created = false;
+      fd = shm_open(shmName.c_str(), O_RDWR, 0600);
+  }
+
+  if (fd == -1)
+      return nullptr;
+
+  struct stat st;
+
+  if (created)
+  {
+      if (ftruncate(fd, off_t(size)) == -1)
+      {
+          close(fd);
+          shm_unlink(shmName.c_str());
+          return nullptr;
+      }
+  }
+  else
+      // The creator may not have set the size yet, give it some time
+      for (int i = 0; i < 100 && !fstat(fd, &st) && st.st_size == 0; ++i)
+          std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  if (fstat(fd, &st) == -1 || size_t(st.st_size) != size)
+  {
+      close(fd);
+      return nullptr;
+  }
+
+  void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd); // The mapping stays valid after closing the descriptor
+
+  if (mem == MAP_FAILED)
+      return nullptr;
+
+#if defined(MADV_HUGEPAGE)
+  madvise(mem, size, MADV_HUGEPAGE);
+#endif
+  return mem;
+}
+
+void shared_memory_free(void* mem, size_t size) {
+  if (mem)
+      munmap(mem, size);
+}
+
+#else
+
+void* shared_memory_alloc(const std::string&, size_t) {
+  return nullptr;
+}
+
+void shared_memory_free(void*, size_t) {}
+
+#endif
+
+
+/// map_file() maps a whole file into memory and returns its address and size,
+/// or nullptr if the file cannot be mapped. The pages are shared with all the
+/// processes mapping the same file, through the page cache, until written to:
+/// a written page becomes a private copy and the file is never modified.
+
+#if defined(__linux__) && !defined(__ANDROID__)
+
+void* map_file(const std::string& fileName, size_t* size) {
+
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd == -1)
+      return nullptr;
+
+  struct stat st;
+
+  if (fstat(fd, &st) == -1 || st.st_size == 0)
+  {
+      close(fd);
+      return nullptr;
+  }
+
+  *size = size_t(st.st_size);
+  void* mem = mmap(nullptr, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd); // The mapping stays valid after closing the descriptor
+
+  return mem == MAP_FAILED ? nullptr : mem;
+}
+
+void unmap_file(void* mem, size_t size) {
+  if (mem)
+      munmap(mem, size);
+}
+
+#else
+
+void* map_file(const std::string&, size_t*) {
+  return nullptr;
+}
+
+void unmap_file(void*, size_t) {}
+
+#endif
+
+
 namespace WinProcGroup {
 
-#ifndef _WIN32
+#if defined(__linux__) && !defined(__ANDROID__)
+
+namespace {
+
+  // Memory policy constants from <numaif.h>, which is part of libnuma and
+  // may be missing, so we use the raw syscall instead.
+  constexpr int MPOL_PREFERRED_  = 1;
+  constexpr int MPOL_INTERLEAVE_ = 3;
+  constexpr unsigned MPOL_MF_MOVE_ = 1 << 1;
+
+  constexpr int MaxNodes = 64; // Fits a single word nodemask
+
+  // NUMA node of the current thread, set by bindThisThread()
+  thread_local int threadNode = -1;
 
-void bindThisThread(size_t) {}
+  // Parses a Linux cpu/node list, like "0-15,32-47", into a vector of indices
+  std::vector<int> parse_list(const std::string& fileName) {
+
+    std::vector<int> list;
+    std::ifstream file(fileName);
+    std::string range;
+
+    while (std::getline(file, range, ','))
+    {
+        int first, last;
+        char dash;
+        std::istringstream is(range);
+
+        if (!(is >> first))
+            break;
+
+        last = (is >> dash >> last) ? last : first;
+
+        for (int i = first; i <= last; ++i)
+            list.push_back(i);
+    }
+
+    return list;
+  }
+
+  // Returns the logical processors of each NUMA node, read once from sysfs. It
+  // is empty on single node machines or if sysfs is not available.
+  const std::vector<std::vector<int>>& numa_nodes() {
+
+    static const std::vector<std::vector<int>> nodes = [] {
+
+      std::vector<std::vector<int>> v;
+
+      for (int n : parse_list("/sys/devices/system/node/online"))
+      {
+          if (n >= MaxNodes)
+              break;
+
+          v.resize(n + 1);
+          v[n] = parse_list("/sys/devices/system/node/node" + std::to_string(n) + "/cpulist");
+      }
+
+      return v.size() > 1 ? v : std::vector<std::vector<int>>();
+    }();
+
+    return nodes;
+  }
+
+  long mbind(void* mem, size_t size, int mode, unsigned long nodeMask, unsigned flags) {
+
+    // mbind() works on whole pages, so shrink the range to the pages it fully covers
+    const uintptr_t pageSize = uintptr_t(sysconf(_SC_PAGESIZE));
+    const uintptr_t start = (uintptr_t(mem) + pageSize - 1) & ~(pageSize - 1);
+    const uintptr_t end   = (uintptr_t(mem) + size) & ~(pageSize - 1);
+
+    if (end <= start)
+        return -1;
+
+    return syscall(SYS_mbind, start, end - start, mode, &nodeMask, MaxNodes + 1, flags);
+  }
+}
+
+
+/// bindThisThread() binds the current thread to the logical processors of a
+/// NUMA node. As on Windows, threads fill a node before moving to the next one.
+
+int bindThisThread(size_t idx) {
+
+  const auto& nodes = numa_nodes();
+  size_t cnt = 0;
+
+  for (size_t n = 0; n < nodes.size(); ++n)
+      if (idx < (cnt += nodes[n].size()))
+      {
+          cpu_set_t mask;
+          CPU_ZERO(&mask);
+
+          for (int cpu : nodes[n])
+              if (cpu < CPU_SETSIZE)
+                  CPU_SET(cpu, &mask);
+
+          if (!sched_setaffinity(0, sizeof(mask), &mask))
+              threadNode = int(n);
+
+          return threadNode;
+      }
+
+  // More threads than logical processors, let the OS decide
+  return -1;
+}
+
+
+/// interleave() spreads the pages of the given memory across all NUMA nodes,
+/// so that a table shared by all the threads has a uniform access cost. Pages
+/// already touched are left where they are.
+
+void interleave(void* mem, size_t size) {
+
+  const auto& nodes = numa_nodes();
+  unsigned long nodeMask = 0;
+
+  for (size_t n = 0; n < nodes.size(); ++n)
+      if (!nodes[n].empty())
+          nodeMask |= 1UL << n;
+
+  if (nodeMask)
+      mbind(mem, size, MPOL_INTERLEAVE_, nodeMask, 0);
+}
+
+
+/// bindToThisNode() moves the given memory to the NUMA node the current thread
+/// has been bound to, so that per-thread data is not accessed remotely.
+
+void bindToThisNode(void* mem, size_t size) {
+
+  if (threadNode >= 0)
+      mbind(mem, size, MPOL_PREFERRED_, 1UL << threadNode, MPOL_MF_MOVE_);
+}
+
+#elif !defined(_WIN32)
+
+int bindThisThread(size_t) { return -1; }
+void interleave(void*, size_t) {}
+void bindToThisNode(void*, size_t) {}
 
 #else
 
@@ -566,13 +1002,13 @@ int best_group(size_t idx) {
 
 /// bindThisThread() set the group affinity of the current thread
 
-void bindThisThread(size_t idx) {
+int bindThisThread(size_t idx) {
 
   // Use only local variables to be thread-safe
   int group = best_group(idx);
 
   if (group == -1)
-      return;
+      return -1;
 
   // Early exit if the needed API are not available at runtime
   HMODULE k32 = GetModuleHandle("Kernel32.dll");
@@ -580,13 +1016,18 @@ void bindThisThread(size_t idx) {
   auto fun3 = (fun3_t)(void(*)())GetProcAddress(k32, "SetThreadGroupAffinity");
 
   if (!fun2 || !fun3)
-      return;
+      return -1;
 
   GROUP_AFFINITY affinity;
-  if (fun2(group, &affinity))
-      fun3(GetCurrentThread(), &affinity, nullptr);
+  if (fun2(group, &affinity) && fun3(GetCurrentThread(), &affinity, nullptr))
+      return group;
+
+  return -1;
 }
 
+void interleave(void*, size_t) {}
+void bindToThisNode(void*, size_t) {}
+
 #endif
 
 } // namespace WinProcGroup
@@ -38,6 +38,19 @@ void* std_aligned_alloc(size_t alignment, size_t size);
 void std_aligned_free(void* ptr);
 void* aligned_large_pages_alloc(size_t size); // memory aligned by page size, min alignment: 4096 bytes
 void aligned_large_pages_free(void* mem); // nop if mem == nullptr
+void set_huge_page_size(size_t size); // 0 to only advise transparent huge pages
+void huge_pages_report(std::ostream& out, const std::string& what, void* mem);
+void* shared_memory_alloc(const std::string& name, size_t size); // nullptr if not available
+void shared_memory_free(void* mem, size_t size); // nop if mem == nullptr
+void* map_file(const std::string& fileName, size_t* size); // copy-on-write, nullptr if not available
+void unmap_file(void* mem, size_t size); // nop if mem == nullptr
+
+#if defined(USE_DISPATCH)
+// Instruction set levels of the NNUE code of a dispatch build
+enum CpuLevel { CPU_SSE2, CPU_SSE41, CPU_AVX2, CPU_AVX512, CPU_VNNI512, CPU_LEVEL_NB };
+CpuLevel cpu_level();
+bool cpu_has_fast_pext();
+#endif
 
 void dbg_hit_on(bool b);
 void dbg_hit_on(bool c, bool b);
@@ -182,10 +195,13 @@ inline uint64_t mul_hi64(uint64_t a, uint64_t b) {
 /// logical processor group. This usually means to be limited to use max 64
 /// cores. To overcome this, some special platform specific API should be
 /// called to set group affinity for each thread. Original code from Texel by
-/// Peter Österlund.
+/// Peter Österlund. On Linux, threads are bound to NUMA nodes in the same way,
+/// and memory can be placed on the nodes with the help of the kernel.
 
 namespace WinProcGroup {
-  void bindThisThread(size_t idx);
+  int bindThisThread(size_t idx);              // returns the node, or -1 if not bound
+  void interleave(void* mem, size_t size);     // nop on single node systems
+  void bindToThisNode(void* mem, size_t size); // nop if thread is not bound
 }
 
 namespace CommandLine {
@@ -28,10 +28,10 @@ namespace {
   template<GenType Type, Direction D>
   ExtMove* make_promotions(ExtMove* moveList, Square to) {
 
-    if (Type == CAPTURES || Type == EVASIONS || Type == NON_EVASIONS)
+    if (Type == CAPTURES || Type == EVASIONS || Type == NON_EVASIONS || Type == LEGAL)
         *moveList++ = make<PROMOTION>(to - D, to, QUEEN);
 
-    if (Type == QUIETS || Type == EVASIONS || Type == NON_EVASIONS)
+    if (Type == QUIETS || Type == EVASIONS || Type == NON_EVASIONS || Type == LEGAL)
     {
         *moveList++ = make<PROMOTION>(to - D, to, ROOK);
         *moveList++ = make<PROMOTION>(to - D, to, BISHOP);
@@ -54,18 +54,45 @@ namespace {
 
     const Bitboard emptySquares = Type == QUIETS || Type == QUIET_CHECKS ? target : ~pos.pieces();
     const Bitboard enemies      = Type == EVASIONS ? pos.checkers()
-                                : Type == CAPTURES ? target : pos.pieces(Them);
+                                : Type == CAPTURES ? target
+                                : Type == LEGAL    ? pos.pieces(Them) & target : pos.pieces(Them);
 
     Bitboard pawnsOn7    = pos.pieces(Us, PAWN) &  TRank7BB;
     Bitboard pawnsNotOn7 = pos.pieces(Us, PAWN) & ~TRank7BB;
 
+    // Pawns allowed to push, and to capture in each direction
+    Bitboard pushers = AllSquares, rightCapturers = AllSquares, leftCapturers = AllSquares;
+
+    // A pinned pawn can only move along the line of its pin
+    if (Type == LEGAL && (pos.blockers_for_king(Us) & pos.pieces(Us, PAWN)))
+    {
+        Square ksq = pos.square<KING>(Us);
+        Bitboard pinned = pos.blockers_for_king(Us) & pos.pieces(Us, PAWN);
+
+        pushers = rightCapturers = leftCapturers = ~pinned;
+
+        while (pinned)
+        {
+            Square s = pop_lsb(pinned);
+
+            if (file_of(s) == file_of(ksq))
+                pushers |= s;
+
+            if (shift<UpRight>(square_bb(s)) & line_bb(ksq, s))
+                rightCapturers |= s;
+
+            if (shift<UpLeft>(square_bb(s)) & line_bb(ksq, s))
+                leftCapturers |= s;
+        }
+    }
+
     // Single and double pawn pushes, no promotions
     if (Type != CAPTURES)
     {
-        Bitboard b1 = shift<Up>(pawnsNotOn7)   & emptySquares;
-        Bitboard b2 = shift<Up>(b1 & TRank3BB) & emptySquares;
+        Bitboard b1 = shift<Up>(pawnsNotOn7 & pushers) & emptySquares;
+        Bitboard b2 = shift<Up>(b1 & TRank3BB)         & emptySquares;
 
-        if (Type == EVASIONS) // Consider only blocking squares
+        if (Type == EVASIONS || Type == LEGAL) // Consider only blocking squares
         {
             b1 &= target;
             b2 &= target;
@@ -98,11 +125,11 @@ namespace {
     // Promotions and underpromotions
     if (pawnsOn7)
     {
-        Bitboard b1 = shift<UpRight>(pawnsOn7) & enemies;
-        Bitboard b2 = shift<UpLeft >(pawnsOn7) & enemies;
-        Bitboard b3 = shift<Up     >(pawnsOn7) & emptySquares;
+        Bitboard b1 = shift<UpRight>(pawnsOn7 & rightCapturers) & enemies;
+        Bitboard b2 = shift<UpLeft >(pawnsOn7 & leftCapturers ) & enemies;
+        Bitboard b3 = shift<Up     >(pawnsOn7 & pushers       ) & emptySquares;
 
-        if (Type == EVASIONS)
+        if (Type == EVASIONS || Type == LEGAL)
             b3 &= target;
 
         while (b1)
@@ -116,10 +143,10 @@ namespace {
     }
 
     // Standard and en passant captures
-    if (Type == CAPTURES || Type == EVASIONS || Type == NON_EVASIONS)
+    if (Type == CAPTURES || Type == EVASIONS || Type == NON_EVASIONS || Type == LEGAL)
     {
-        Bitboard b1 = shift<UpRight>(pawnsNotOn7) & enemies;
-        Bitboard b2 = shift<UpLeft >(pawnsNotOn7) & enemies;
+        Bitboard b1 = shift<UpRight>(pawnsNotOn7 & rightCapturers) & enemies;
+        Bitboard b2 = shift<UpLeft >(pawnsNotOn7 & leftCapturers ) & enemies;
 
         while (b1)
         {
@@ -145,8 +172,15 @@ namespace {
 
             assert(b1);
 
+            // The legality of en passant captures, which remove two pieces from
+            // the lines of the king, is left to Position::legal(), as they are rare.
             while (b1)
-                *moveList++ = make<EN_PASSANT>(pop_lsb(b1), pos.ep_square());
+            {
+                Move m = make<EN_PASSANT>(pop_lsb(b1), pos.ep_square());
+
+                if (Type != LEGAL || pos.legal(m))
+                    *moveList++ = m;
+            }
         }
     }
 
@@ -154,18 +188,28 @@ namespace {
   }
 
 
-  template<Color Us, PieceType Pt, bool Checks>
+  template<Color Us, PieceType Pt, bool Checks, bool Legal = false>
   ExtMove* generate_moves(const Position& pos, ExtMove* moveList, Bitboard target) {
 
     static_assert(Pt != KING && Pt != PAWN, "Unsupported piece type in generate_moves()");
 
     Bitboard bb = pos.pieces(Us, Pt);
+    Bitboard pinned = Legal ? pos.blockers_for_king(Us) & bb : 0;
+
+    // A pinned piece can only move along the line of its pin, which a knight
+    // never does. In check, it may still take a checker on that line, as the
+    // pins are found ignoring the other enemy sliders.
+    if (Legal && Pt == KNIGHT)
+        bb &= ~pinned;
 
     while (bb)
     {
         Square from = pop_lsb(bb);
         Bitboard b = attacks_bb<Pt>(from, pos.pieces()) & target;
 
+        if (Legal && (pinned & from))
+            b &= line_bb(pos.square<KING>(Us), from);
+
         // To check, you either move freely a blocker or make a direct check.
         if (Checks && (Pt == QUEEN || !(pos.blockers_for_king(~Us) & from)))
             b &= pos.check_squares(Pt);
@@ -220,6 +264,52 @@ namespace {
     return moveList;
   }
 
+
+  template<Color Us>
+  ExtMove* generate_legal(const Position& pos, ExtMove* moveList) {
+
+    const Square ksq = pos.square<KING>(Us);
+
+    // Skip generating non-king moves when in double check
+    if (!more_than_one(pos.checkers()))
+    {
+        // When in check, the other pieces must capture the checker or block
+        const Bitboard target = pos.checkers() ? between_bb(ksq, lsb(pos.checkers()))
+                                               : ~pos.pieces(Us);
+
+        moveList = generate_pawn_moves<Us, LEGAL>(pos, moveList, target);
+        moveList = generate_moves<Us, KNIGHT, false, true>(pos, moveList, target);
+        moveList = generate_moves<Us, BISHOP, false, true>(pos, moveList, target);
+        moveList = generate_moves<Us,   ROOK, false, true>(pos, moveList, target);
+        moveList = generate_moves<Us,  QUEEN, false, true>(pos, moveList, target);
+    }
+
+    // The king must not be attacked on its new square, also by the sliders
+    // whose line it leaves.
+    Bitboard b = attacks_bb<KING>(ksq) & ~pos.pieces(Us);
+
+    while (b)
+    {
+        Square to = pop_lsb(b);
+
+        if (!(pos.attackers_to(to, pos.pieces() ^ ksq) & pos.pieces(~Us)))
+            *moveList++ = make_move(ksq, to);
+    }
+
+    // Whether the castling path is attacked is left to Position::legal()
+    if (!pos.checkers() && pos.can_castle(Us & ANY_CASTLING))
+        for (CastlingRights cr : { Us & KING_SIDE, Us & QUEEN_SIDE } )
+            if (!pos.castling_impeded(cr) && pos.can_castle(cr))
+            {
+                Move m = make<CASTLING>(ksq, pos.castling_rook_square(cr));
+
+                if (pos.legal(m))
+                    *moveList++ = m;
+            }
+
+    return moveList;
+  }
+
 } // namespace
 
 
@@ -251,26 +341,18 @@ template ExtMove* generate<QUIET_CHECKS>(const Position&, ExtMove*);
 template ExtMove* generate<NON_EVASIONS>(const Position&, ExtMove*);
 
 
-/// generate<LEGAL> generates all the legal moves in the given position
+/// generate<LEGAL> generates all the legal moves in the given position. Rather
+/// than filtering the pseudo-legal moves with Position::legal(), the moves are
+/// restricted with the pinned pieces and the checkers of the position, so that
+/// only the castlings and en passant captures need a full test.
 
 template<>
 ExtMove* generate<LEGAL>(const Position& pos, ExtMove* moveList) {
 
   Color us = pos.side_to_move();
-  Bitboard pinned = pos.blockers_for_king(us) & pos.pieces(us);
-  Square ksq = pos.square<KING>(us);
-  ExtMove* cur = moveList;
-
-  moveList = pos.checkers() ? generate<EVASIONS    >(pos, moveList)
-                            : generate<NON_EVASIONS>(pos, moveList);
-  while (cur != moveList)
-      if (  ((pinned && pinned & from_sq(*cur)) || from_sq(*cur) == ksq || type_of(*cur) == EN_PASSANT)
-          && !pos.legal(*cur))
-          *cur = (--moveList)->move;
-      else
-          ++cur;
-
-  return moveList;
+
+  return us == WHITE ? generate_legal<WHITE>(pos, moveList)
+                     : generate_legal<BLACK>(pos, moveList);
 }
 
 } // namespace Stockfish
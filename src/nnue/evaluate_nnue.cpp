@@ -27,23 +27,110 @@
 #include "../evaluate.h"
 #include "../position.h"
 #include "../misc.h"
+#include "../thread.h"
 #include "../uci.h"
 #include "../types.h"
 
 #include "evaluate_nnue.h"
 
 namespace Stockfish::Eval::NNUE {
+NNUE_VARIANT_BEGIN
 
-  // Input feature converter
-  LargePagePtr<FeatureTransformer> featureTransformer;
+  // Parameters of a net of a given width
+  template <IndexType Width>
+  struct Parameters {
+    LargePagePtr<FeatureTransformer<Width>> featureTransformer; // Input feature converter
+    AlignedPtr<Network<Width>> network[LayerStacks];            // Evaluation function
+  };
+
+  template <typename Widths>
+  struct AllParameters;
+
+  template <IndexType... Widths>
+  struct AllParameters<std::integer_sequence<IndexType, Widths...>> : Parameters<Widths>... {};
+
+  // Parameters of all the widths, kept in a single object so that they are
+  // destroyed after the mapped net below. Only those of the width of the
+  // loaded net are allocated.
+  AllParameters<TransformedFeatureWidths> parameters;
+
+  template <IndexType Width>
+  auto& featureTransformer = static_cast<Parameters<Width>&>(parameters).featureTransformer;
 
-  // Evaluation function
-  AlignedPtr<Network> network[LayerStacks];
+  template <IndexType Width>
+  auto& network = static_cast<Parameters<Width>&>(parameters).network;
+
+  // Width of the loaded net
+  IndexType netWidth = DefaultTransformedFeatureDimensions;
 
   // Evaluation function file name
   std::string fileName;
   std::string netDescription;
 
+  // File mapped into memory the parameters are used from, if any. The pointers
+  // above point into it then, and do not own their memory. It is unmapped at
+  // exit before the pointers are destroyed.
+  struct MappedNet {
+    void* mem;
+    std::size_t size;
+    ~MappedNet();
+  } mappedNet;
+
+  // Version of the mapped format, in which the parameters are stored as they
+  // are laid out in memory, each object starting at a page boundary
+  constexpr std::uint32_t MappedVersion = Version + 1;
+
+  // Version of compressed nets, in which the parameters of the feature
+  // transformer are LEB128 encoded
+  constexpr std::uint32_t CompressedVersion = Version + 2;
+  constexpr std::size_t MappedAlignment = 4096;
+
+  // Instruction sets the memory layout of the parameters may depend on. A mapped
+  // net can only be used by a build, or dispatch variant, with the same ones.
+  constexpr std::uint32_t LayoutFlags = 0
+#if defined(USE_SSE2)
+                                      | 1 << 0
+#endif
+#if defined(USE_SSSE3)
+                                      | 1 << 1
+#endif
+#if defined(USE_SSE41)
+                                      | 1 << 2
+#endif
+#if defined(USE_AVX2)
+                                      | 1 << 3
+#endif
+#if defined(USE_AVX512)
+                                      | 1 << 4
+#endif
+#if defined(USE_VNNI)
+                                      | 1 << 5
+#endif
+#if defined(USE_MMX)
+                                      | 1 << 6
+#endif
+#if defined(USE_NEON)
+                                      | 1 << 7
+#endif
+#if defined(IS_64BIT)
+                                      | 1 << 8
+#endif
+                                      ;
+
+  // Size of an object in the mapped format, rounded up to the alignment
+  constexpr std::size_t mapped_block(std::size_t n) { return ceil_to_multiple(n, MappedAlignment); }
+
+  // Size of the parameters of a net of the given width in the mapped format
+  template <IndexType Width>
+  constexpr std::size_t mapped_size() {
+
+    static_assert(std::is_trivially_copyable_v<FeatureTransformer<Width>>);
+    static_assert(std::is_trivially_copyable_v<Network<Width>>);
+    static_assert(alignof(FeatureTransformer<Width>) <= MappedAlignment && alignof(Network<Width>) <= MappedAlignment);
+
+    return mapped_block(sizeof(FeatureTransformer<Width>)) + LayerStacks * mapped_block(sizeof(Network<Width>));
+  }
+
   namespace Detail {
 
   // Initialize the evaluation function parameters
@@ -63,82 +150,200 @@ namespace Stockfish::Eval::NNUE {
   }
 
   // Read evaluation function parameters
-  template <typename T>
-  bool read_parameters(std::istream& stream, T& reference) {
+  template <typename T, typename... Args>
+  bool read_parameters(std::istream& stream, T& reference, Args... args) {
 
     std::uint32_t header;
     header = read_little_endian<std::uint32_t>(stream);
     if (!stream || header != T::get_hash_value()) return false;
-    return reference.read_parameters(stream);
+    return reference.read_parameters(stream, args...);
   }
 
   // Write evaluation function parameters
-  template <typename T>
-  bool write_parameters(std::ostream& stream, const T& reference) {
+  template <typename T, typename... Args>
+  bool write_parameters(std::ostream& stream, const T& reference, Args... args) {
 
     write_little_endian<std::uint32_t>(stream, T::get_hash_value());
-    return reference.write_parameters(stream);
+    return reference.write_parameters(stream, args...);
   }
 
   }  // namespace Detail
 
-  // Initialize the evaluation function parameters
-  void initialize() {
+  // Call f with each supported width, as an std::integral_constant
+  template <typename F, IndexType... Widths>
+  void for_each_width(F&& f, std::integer_sequence<IndexType, Widths...>) {
 
-    Detail::initialize(featureTransformer);
-    for (std::size_t i = 0; i < LayerStacks; ++i)
-      Detail::initialize(network[i]);
+    (f(std::integral_constant<IndexType, Widths>{}), ...);
+  }
+
+  template <typename F>
+  void for_each_width(F&& f) {
+
+    for_each_width(std::forward<F>(f), TransformedFeatureWidths{});
+  }
+
+  // Call f with the width w, as an std::integral_constant, so that the code
+  // of the instantiation for this width is run
+  template <typename F, IndexType Width, IndexType... Widths>
+  auto with_width(IndexType w, F&& f, std::integer_sequence<IndexType, Width, Widths...>) {
+
+    if constexpr (sizeof...(Widths) > 0)
+      if (w != Width)
+        return with_width(w, std::forward<F>(f), std::integer_sequence<IndexType, Widths...>{});
+
+    return f(std::integral_constant<IndexType, Width>{});
+  }
+
+  template <typename F>
+  auto with_width(IndexType w, F&& f) {
+
+    return with_width(w, std::forward<F>(f), TransformedFeatureWidths{});
+  }
+
+  // Width of the nets with the given hash value, or 0 if it is not supported
+  IndexType width_of(std::uint32_t hashValue) {
+
+    IndexType w = 0;
+    for_each_width([&](auto width) { if (hashValue == HashValue<width>) w = width; });
+    return w;
+  }
+
+  // Unmap the mapped net, if any, after releasing the pointers into it
+  void unmap() {
+
+    if (!mappedNet.mem)
+      return;
+
+    with_width(netWidth, [](auto width) {
+      featureTransformer<width>.release();
+      for (std::size_t i = 0; i < LayerStacks; ++i)
+        network<width>[i].release();
+    });
+
+    unmap_file(mappedNet.mem, mappedNet.size);
+    mappedNet.mem = nullptr;
+  }
+
+  MappedNet::~MappedNet() { unmap(); }
+
+  // Free the evaluation function parameters of all the widths
+  void free_parameters() {
+
+    unmap();
+    for_each_width([](auto width) {
+      featureTransformer<width>.reset();
+      for (std::size_t i = 0; i < LayerStacks; ++i)
+        network<width>[i].reset();
+    });
+  }
+
+  // Initialize the evaluation function parameters for a net of the given width.
+  // Even a net left zeroed gets an id, for the accumulator caches to be reset
+  // and allocated when it is used.
+  void initialize(IndexType w) {
+
+    free_parameters();
+    with_width(w, [](auto width) {
+      Detail::initialize(featureTransformer<width>);
+      featureTransformer<width>->renew_net_id();
+      for (std::size_t i = 0; i < LayerStacks; ++i)
+        Detail::initialize(network<width>[i]);
+    });
+    netWidth = w;
   }
 
   // Read network header
-  bool read_header(std::istream& stream, std::uint32_t* hashValue, std::string* desc)
+  bool read_header(std::istream& stream, std::uint32_t* hashValue, std::string* desc, bool* compressed)
   {
     std::uint32_t version, size;
 
     version     = read_little_endian<std::uint32_t>(stream);
     *hashValue  = read_little_endian<std::uint32_t>(stream);
     size        = read_little_endian<std::uint32_t>(stream);
-    if (!stream || version != Version) return false;
+    if (!stream || (version != Version && version != CompressedVersion)) return false;
+    *compressed = version == CompressedVersion;
     desc->resize(size);
     stream.read(&(*desc)[0], size);
     return !stream.fail();
   }
 
   // Write network header
-  bool write_header(std::ostream& stream, std::uint32_t hashValue, const std::string& desc)
+  bool write_header(std::ostream& stream, std::uint32_t hashValue, const std::string& desc, bool compressed)
   {
-    write_little_endian<std::uint32_t>(stream, Version);
+    write_little_endian<std::uint32_t>(stream, compressed ? CompressedVersion : Version);
     write_little_endian<std::uint32_t>(stream, hashValue);
     write_little_endian<std::uint32_t>(stream, desc.size());
     stream.write(&desc[0], desc.size());
     return !stream.fail();
   }
 
-  // Read network parameters
-  bool read_parameters(std::istream& stream) {
+  // Read network parameters of the given width
+  template <IndexType Width>
+  bool read_parameters(std::istream& stream, bool compressed) {
 
-    std::uint32_t hashValue;
-    if (!read_header(stream, &hashValue, &netDescription)) return false;
-    if (hashValue != HashValue) return false;
-    if (!Detail::read_parameters(stream, *featureTransformer)) return false;
+    if (!Detail::read_parameters(stream, *featureTransformer<Width>, compressed)) return false;
     for (std::size_t i = 0; i < LayerStacks; ++i)
-      if (!Detail::read_parameters(stream, *(network[i]))) return false;
+      if (!Detail::read_parameters(stream, *(network<Width>[i]))) return false;
     return stream && stream.peek() == std::ios::traits_type::eof();
   }
 
+  // Read network parameters, allocated for the width given by the hash value
+  // of the header. If the net cannot be read, the parameters are left zeroed
+  // with the default width.
+  bool read_parameters(std::istream& stream) {
+
+    std::uint32_t hashValue;
+    bool compressed;
+    const bool header = read_header(stream, &hashValue, &netDescription, &compressed);
+    const IndexType w = header ? width_of(hashValue) : 0;
+
+    initialize(w ? w : DefaultTransformedFeatureDimensions);
+    if (!w) return false;
+
+    return with_width(w, [&](auto width) { return read_parameters<width>(stream, compressed); });
+  }
+
   // Write network parameters
-  bool write_parameters(std::ostream& stream) {
+  template <IndexType Width>
+  bool write_parameters(std::ostream& stream, bool compressed) {
 
-    if (!write_header(stream, HashValue, netDescription)) return false;
-    if (!Detail::write_parameters(stream, *featureTransformer)) return false;
+    if (!write_header(stream, HashValue<Width>, netDescription, compressed)) return false;
+    if (!Detail::write_parameters(stream, *featureTransformer<Width>, compressed)) return false;
     for (std::size_t i = 0; i < LayerStacks; ++i)
-      if (!Detail::write_parameters(stream, *(network[i]))) return false;
+      if (!Detail::write_parameters(stream, *(network<Width>[i]))) return false;
     return (bool)stream;
   }
 
-  // Evaluation function. Perform differential calculation.
+  // Final value of a position from the outputs of the network. The positional
+  // part is given more weight when the material is nearly balanced, if adjusted.
+  static Value combine(const Position& pos, int materialist, int positional, bool adjusted) {
+
+    int delta_npm = abs(pos.non_pawn_material(WHITE) - pos.non_pawn_material(BLACK));
+    int entertainment = (adjusted && delta_npm <= BishopValueMg - KnightValueMg ? 7 : 0);
+
+    int A = 128 - entertainment;
+    int B = 128 + entertainment;
+
+    int sum = (A * materialist + B * positional) / 128;
+
+    return static_cast<Value>( sum / OutputScale );
+  }
+
+  // Evaluation function. Perform differential calculation. The adjusted values,
+  // those used in search, go through the evaluation cache of the thread.
+  template <IndexType Width>
   Value evaluate(const Position& pos, bool adjusted) {
 
+    using FeatureTransformer = NNUE::FeatureTransformer<Width>;
+    using Network = NNUE::Network<Width>;
+
+    Thread* thread = pos.this_thread();
+    EvalCache& cache = thread->evalCache;
+    Value v;
+
+    if (adjusted && cache.probe(pos.key(), featureTransformer<Width>->net_id(), v))
+      return v;
+
     // We manually align the arrays on the stack because with gcc < 9.3
     // overaligning stack variables with alignas() doesn't work correctly.
 
@@ -161,23 +366,138 @@ namespace Stockfish::Eval::NNUE {
     ASSERT_ALIGNED(buffer, alignment);
 
     const std::size_t bucket = (pos.count<ALL_PIECES>() - 1) / 4;
-    const auto psqt = featureTransformer->transform(pos, transformedFeatures, bucket);
-    const auto output = network[bucket]->propagate(transformedFeatures, buffer);
+    const auto psqt = featureTransformer<Width>->transform(pos, thread->accumulatorStack, thread->accumulatorCaches,
+                                                           transformedFeatures, bucket);
+    const auto output = network<Width>[bucket]->propagate(transformedFeatures, buffer);
 
-    int materialist = psqt;
-    int positional  = output[0];
+    v = combine(pos, psqt, output[0], adjusted);
 
-    int delta_npm = abs(pos.non_pawn_material(WHITE) - pos.non_pawn_material(BLACK));
-    int entertainment = (adjusted && delta_npm <= BishopValueMg - KnightValueMg ? 7 : 0);
+    if (adjusted)
+      cache.store(pos.key(), v);
 
-    int A = 128 - entertainment;
-    int B = 128 + entertainment;
+    return v;
+  }
 
-    int sum = (A * materialist + B * positional) / 128;
+  Value evaluate(const Position& pos, bool adjusted) {
 
-    return static_cast<Value>( sum / OutputScale );
+    return with_width(netWidth, [&](auto width) { return evaluate<width>(pos, adjusted); });
+  }
+
+  // PSQT part of the evaluation, a material estimate that skips the transform
+  // of the accumulators and the layers. Same scale as evaluate(pos, false).
+  template <IndexType Width>
+  Value evaluate_psqt(const Position& pos) {
+
+    Thread* thread = pos.this_thread();
+    const std::size_t bucket = (pos.count<ALL_PIECES>() - 1) / 4;
+    const auto psqt = featureTransformer<Width>->psqt(pos, thread->accumulatorStack, thread->accumulatorCaches, bucket);
+
+    return static_cast<Value>( psqt / OutputScale );
+  }
+
+  Value evaluate_psqt(const Position& pos) {
+
+    return with_width(netWidth, [&](auto width) { return evaluate_psqt<width>(pos); });
+  }
+
+  // Evaluation of several positions at once. The positions are grouped by
+  // bucket, and the layers of a bucket propagate each group as a whole, so
+  // that the weights of the dense layers are read once for all the positions
+  // of the group.
+  // The values are the same as those of evaluate().
+  template <IndexType Width>
+  void evaluate_batch(const Position* const positions[], std::size_t count,
+                      Value values[], bool adjusted) {
+
+    using FeatureTransformer = NNUE::FeatureTransformer<Width>;
+    using Network = NNUE::Network<Width>;
+
+    constexpr uint64_t alignment = CacheLineSize;
+
+    // The transformed features and the propagation buffer of each position of
+    // a chunk are stored next to each other, so that the inputs and outputs of
+    // every layer are Stride bytes apart from one position to the next.
+    constexpr std::size_t FeaturesSize = FeatureTransformer::BufferSize * sizeof(TransformedFeatureType);
+    constexpr std::size_t Stride = FeaturesSize + Network::BufferSize;
+    static_assert(FeaturesSize % alignment == 0 && Network::BufferSize % alignment == 0);
+
+#if defined(ALIGNAS_ON_STACK_VARIABLES_BROKEN)
+    char blocksUnaligned[MaxBatchSize * Stride + alignment];
+
+    auto* blocks = align_ptr_up<alignment>(&blocksUnaligned[0]);
+#else
+    alignas(alignment) char blocks[MaxBatchSize * Stride];
+#endif
+
+    ASSERT_ALIGNED(blocks, alignment);
+
+    for (std::size_t first = 0; first < count; first += MaxBatchSize)
+    {
+        const std::size_t n = std::min(count - first, MaxBatchSize);
+        const Position* const* pos = positions + first;
+        std::size_t order[MaxBatchSize], start[LayerStacks + 1] = {};
+        std::int32_t psqt[MaxBatchSize];
+
+        // Counting sort of the positions by bucket
+        for (std::size_t i = 0; i < n; ++i)
+            ++start[(pos[i]->count<ALL_PIECES>() - 1) / 4 + 1];
+
+        for (std::size_t b = 0; b < LayerStacks; ++b)
+            start[b + 1] += start[b];
+
+        std::size_t next[LayerStacks];
+        std::copy(start, start + LayerStacks, next);
+
+        for (std::size_t i = 0; i < n; ++i)
+            order[next[(pos[i]->count<ALL_PIECES>() - 1) / 4]++] = i;
+
+        // Transform the positions into their block, in bucket order
+        for (std::size_t k = 0; k < n; ++k)
+        {
+            const Position& p = *pos[order[k]];
+            const std::size_t bucket = (p.count<ALL_PIECES>() - 1) / 4;
+            const auto transformedFeatures = reinterpret_cast<TransformedFeatureType*>(blocks + k * Stride);
+            psqt[k] = featureTransformer<Width>->transform(p, p.this_thread()->accumulatorStack, p.this_thread()->accumulatorCaches,
+                                                           transformedFeatures, bucket);
+        }
+
+        // Propagate the group of each bucket
+        for (std::size_t b = 0; b < LayerStacks; ++b)
+        {
+            const IndexType size = IndexType(start[b + 1] - start[b]);
+            if (!size)
+                continue;
+
+            char* block = blocks + start[b] * Stride;
+            const auto output = network<Width>[b]->propagate_batch(
+                reinterpret_cast<TransformedFeatureType*>(block), block + FeaturesSize, size, Stride);
+
+            for (IndexType i = 0; i < size; ++i)
+            {
+                const std::size_t k = start[b] + i;
+                values[first + order[k]] = combine(*pos[order[k]], psqt[k], *batch_at(output, i, Stride), adjusted);
+            }
+        }
+    }
+  }
+
+  void evaluate_batch(const Position* const positions[], std::size_t count,
+                      Value values[], bool adjusted) {
+
+    with_width(netWidth, [&](auto width) { evaluate_batch<width>(positions, count, values, adjusted); });
+  }
+
+  // Prefetch the weights of the features changed by the last move, so that
+  // they are in cache when the next evaluation updates the accumulators
+  void prefetch_weights(const Position& pos) {
+
+    with_width(netWidth, [&](auto width) { featureTransformer<width>->prefetch_weights(pos); });
   }
 
+  // Width of the transformed features of the loaded net, that the accumulators
+  // of the threads are allocated for
+  std::uint32_t transformed_width() { return netWidth; }
+
   struct NnueEvalTrace {
     static_assert(LayerStacks == PSQTBuckets);
 
@@ -186,8 +506,12 @@ namespace Stockfish::Eval::NNUE {
     std::size_t correctBucket;
   };
 
+  template <IndexType Width>
   static NnueEvalTrace trace_evaluate(const Position& pos) {
 
+    using FeatureTransformer = NNUE::FeatureTransformer<Width>;
+    using Network = NNUE::Network<Width>;
+
     // We manually align the arrays on the stack because with gcc < 9.3
     // overaligning stack variables with alignas() doesn't work correctly.
 
@@ -209,11 +533,13 @@ namespace Stockfish::Eval::NNUE {
     ASSERT_ALIGNED(transformedFeatures, alignment);
     ASSERT_ALIGNED(buffer, alignment);
 
+    Thread* thread = pos.this_thread();
     NnueEvalTrace t{};
     t.correctBucket = (pos.count<ALL_PIECES>() - 1) / 4;
     for (std::size_t bucket = 0; bucket < LayerStacks; ++bucket) {
-      const auto psqt = featureTransformer->transform(pos, transformedFeatures, bucket);
-      const auto output = network[bucket]->propagate(transformedFeatures, buffer);
+      const auto psqt = featureTransformer<Width>->transform(pos, thread->accumulatorStack, thread->accumulatorCaches,
+                                                             transformedFeatures, bucket);
+      const auto output = network<Width>[bucket]->propagate(transformedFeatures, buffer);
 
       int materialist = psqt;
       int positional  = output[0];
@@ -323,7 +649,7 @@ namespace Stockfish::Eval::NNUE {
 
     // We estimate the value of each piece by doing a differential evaluation from
     // the current base eval, simulating the removal of the piece from its square.
-    Value base = evaluate(pos);
+    Value base = evaluate(pos, false);
     base = pos.side_to_move() == WHITE ? base : -base;
 
     for (File f = FILE_A; f <= FILE_H; ++f)
@@ -338,16 +664,16 @@ namespace Stockfish::Eval::NNUE {
           auto st = pos.state();
 
           pos.remove_piece(sq);
-          st->accumulator.computed[WHITE] = false;
-          st->accumulator.computed[BLACK] = false;
+          st->accumulator->computed[WHITE] = false;
+          st->accumulator->computed[BLACK] = false;
 
-          Value eval = evaluate(pos);
+          Value eval = evaluate(pos, false);
           eval = pos.side_to_move() == WHITE ? eval : -eval;
           v = base - eval;
 
           pos.put_piece(pc, sq);
-          st->accumulator.computed[WHITE] = false;
-          st->accumulator.computed[BLACK] = false;
+          st->accumulator->computed[WHITE] = false;
+          st->accumulator->computed[BLACK] = false;
         }
 
         writeSquare(f, r, pc, v);
@@ -358,7 +684,7 @@ namespace Stockfish::Eval::NNUE {
         ss << board[row] << '\n';
     ss << '\n';
 
-    auto t = trace_evaluate(pos);
+    auto t = with_width(netWidth, [&](auto width) { return trace_evaluate<width>(pos); });
 
     ss << " NNUE network contributions "
        << (pos.side_to_move() == WHITE ? "(White to move)" : "(Black to move)") << std::endl
@@ -393,24 +719,30 @@ namespace Stockfish::Eval::NNUE {
 
 
   // Load eval, from a file stream or a memory stream
-  bool load_eval(std::string name, std::istream& stream) {
+  bool load_eval(std::string name, std::istream& stream, std::ostream& out) {
 
-    initialize();
     fileName = name;
-    return read_parameters(stream);
+
+    bool loaded = read_parameters(stream);
+    if (loaded)
+        with_width(netWidth, [&](auto width) {
+          huge_pages_report(out, "NNUE weights", featureTransformer<width>.get());
+        });
+
+    return loaded;
   }
 
-  // Save eval, to a file stream or a memory stream
-  bool save_eval(std::ostream& stream) {
+  // Save eval, to a file stream or a memory stream, compressed if asked for
+  bool save_eval(std::ostream& stream, bool compressed) {
 
     if (fileName.empty())
       return false;
 
-    return write_parameters(stream);
+    return with_width(netWidth, [&](auto width) { return write_parameters<width>(stream, compressed); });
   }
 
   /// Save eval, to a file given by its name
-  bool save_eval(const std::optional<std::string>& filename) {
+  bool save_eval(const std::optional<std::string>& filename, std::ostream& out, bool compressed) {
 
     std::string actualFilename;
     std::string msg;
@@ -423,21 +755,113 @@ namespace Stockfish::Eval::NNUE {
         {
              msg = "Failed to export a net. A non-embedded net can only be saved if the filename is specified";
 
-             sync_cout << msg << sync_endl;
+             out << IO_LOCK << msg << sync_endl;
              return false;
         }
         actualFilename = EvalFileDefaultName;
     }
 
     std::ofstream stream(actualFilename, std::ios_base::binary);
-    bool saved = save_eval(stream);
+    bool saved = save_eval(stream, compressed);
 
     msg = saved ? "Network saved successfully to " + actualFilename
                 : "Failed to export a net";
 
-    sync_cout << msg << sync_endl;
+    out << IO_LOCK << msg << sync_endl;
+    return saved;
+  }
+
+  // Load eval from a file in the mapped format. The parameters are used in
+  // place, so the pages of the file are shared by all the processes using it
+  // and nothing is parsed. Returns false, without changing the current net, if
+  // the file cannot be mapped or is not a mapped net for this build.
+  bool map_eval(std::string name, const std::string& path) {
+
+    std::size_t size;
+    char* mem = static_cast<char*>(map_file(path, &size));
+    if (!mem)
+      return false;
+
+    std::uint32_t header[4] = {};
+    if (size >= sizeof(header))
+      std::memcpy(header, mem, sizeof(header));
+
+    const std::size_t offset = mapped_block(sizeof(header) + header[3]);
+    const IndexType w = width_of(header[1]);
+
+    if (   header[0] != MappedVersion
+        || !w
+        || header[2] != LayoutFlags
+        || size != offset + with_width(w, [](auto width) { return mapped_size<width>(); }))
+    {
+      unmap_file(mem, size);
+      return false;
+    }
+
+    free_parameters();
+
+    with_width(w, [&](auto width) {
+      char* p = mem + offset;
+      featureTransformer<width>.reset(reinterpret_cast<FeatureTransformer<width>*>(p));
+      p += mapped_block(sizeof(FeatureTransformer<width>));
+      for (std::size_t i = 0; i < LayerStacks; ++i, p += mapped_block(sizeof(Network<width>)))
+        network<width>[i].reset(reinterpret_cast<Network<width>*>(p));
+
+      // Only the page of the id becomes private to the process
+      featureTransformer<width>->renew_net_id();
+    });
+
+    netWidth = w;
+    mappedNet = { mem, size };
+    fileName = name;
+    netDescription.assign(mem + sizeof(header), header[3]);
+
+    return true;
+  }
+
+  /// Save eval in the mapped format, to a file given by its name
+  bool save_eval_mapped(const std::string& filename, std::ostream& out) {
+
+    bool saved = false;
+
+    if (!fileName.empty())
+    {
+      std::ofstream stream(filename, std::ios_base::binary);
+
+      auto pad = [&]() {
+        const std::size_t pos = std::size_t(stream.tellp());
+        const std::string zeros(ceil_to_multiple(pos, MappedAlignment) - pos, '\0');
+        stream.write(zeros.data(), zeros.size());
+      };
+
+      with_width(netWidth, [&](auto width) {
+        const std::uint32_t header[4] = { MappedVersion, HashValue<width>, LayoutFlags, std::uint32_t(netDescription.size()) };
+        stream.write(reinterpret_cast<const char*>(header), sizeof(header));
+        stream.write(netDescription.data(), netDescription.size());
+        pad();
+        stream.write(reinterpret_cast<const char*>(featureTransformer<width>.get()), sizeof(FeatureTransformer<width>));
+        pad();
+        for (std::size_t i = 0; i < LayerStacks; ++i)
+        {
+          stream.write(reinterpret_cast<const char*>(network<width>[i].get()), sizeof(Network<width>));
+          pad();
+        }
+      });
+
+      saved = bool(stream);
+    }
+
+    out << IO_LOCK << (saved ? "Network saved successfully to " + filename
+                             : std::string("Failed to export a net")) << sync_endl;
     return saved;
   }
 
+#if defined(NNUE_VARIANT)
+  // Entry points of this variant, for the dispatcher in evaluate.cpp
+  extern const Kernels kernels = { evaluate, evaluate_psqt, evaluate_batch, prefetch_weights, transformed_width, trace,
+                                   load_eval, map_eval, save_eval, save_eval, save_eval_mapped };
+#endif
+
 
+NNUE_VARIANT_END
 } // namespace Stockfish::Eval::NNUE
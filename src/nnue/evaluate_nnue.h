@@ -26,10 +26,13 @@
 #include <memory>
 
 namespace Stockfish::Eval::NNUE {
+NNUE_VARIANT_BEGIN
 
   // Hash value of evaluation function structure
+  template <IndexType TransformedFeatureDimensions>
   constexpr std::uint32_t HashValue =
-      FeatureTransformer::get_hash_value() ^ Network::get_hash_value();
+      FeatureTransformer<TransformedFeatureDimensions>::get_hash_value()
+    ^ Network<TransformedFeatureDimensions>::get_hash_value();
 
   // Deleter for automating release of memory area
   template <typename T>
@@ -54,6 +57,7 @@ namespace Stockfish::Eval::NNUE {
   template <typename T>
   using LargePagePtr = std::unique_ptr<T, LargePageDeleter<T>>;
 
+NNUE_VARIANT_END
 }  // namespace Stockfish::Eval::NNUE
 
 #endif // #ifndef NNUE_EVALUATE_NNUE_H_INCLUDED
@@ -70,6 +70,33 @@ namespace Stockfish::Eval::NNUE::Features {
     }
   }
 
+  // append_board_changes() : get a list of indices for the features to remove
+  // from and add to a board, so that it matches the position
+
+  void HalfKAv2::append_board_changes(
+    const Position& pos,
+    Color perspective,
+    const Bitboard byColorBB[COLOR_NB],
+    const Bitboard byTypeBB[PIECE_TYPE_NB],
+    ValueListInserter<IndexType> removed,
+    ValueListInserter<IndexType> added
+  ) {
+    Square ksq = orient(perspective, pos.square<KING>(perspective));
+    for (Color c : { WHITE, BLACK })
+      for (PieceType pt = PAWN; pt <= KING; ++pt)
+      {
+        Piece pc = make_piece(c, pt);
+        Bitboard before = byColorBB[c] & byTypeBB[pt];
+        Bitboard now = pos.pieces(c, pt);
+        Bitboard toRemove = before & ~now;
+        Bitboard toAdd = now & ~before;
+        while (toRemove)
+          removed.push_back(make_index(perspective, pop_lsb(toRemove), pc, ksq));
+        while (toAdd)
+          added.push_back(make_index(perspective, pop_lsb(toAdd), pc, ksq));
+      }
+  }
+
   int HalfKAv2::update_cost(StateInfo* st) {
     return st->dirtyPiece.dirty_num;
   }
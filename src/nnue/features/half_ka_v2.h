@@ -96,6 +96,16 @@ namespace Stockfish::Eval::NNUE::Features {
       ValueListInserter<IndexType> removed,
       ValueListInserter<IndexType> added);
 
+    // Get the lists of features that differ between the pieces of the position
+    // and the board given by its bitboards, with the same king square
+    static void append_board_changes(
+      const Position& pos,
+      Color perspective,
+      const Bitboard byColorBB[COLOR_NB],
+      const Bitboard byTypeBB[PIECE_TYPE_NB],
+      ValueListInserter<IndexType> removed,
+      ValueListInserter<IndexType> added);
+
     // Returns the cost of updating one perspective, the most costly one.
     // Assumes no refresh needed.
     static int update_cost(StateInfo* st);
@@ -25,6 +25,7 @@
 #include "../nnue_common.h"
 
 namespace Stockfish::Eval::NNUE::Layers {
+NNUE_VARIANT_BEGIN
 
   // Affine transformation layer
   template <typename PreviousLayer, IndexType OutDims>
@@ -46,6 +47,12 @@ namespace Stockfish::Eval::NNUE::Layers {
 #elif defined (USE_SSSE3)
     static constexpr const IndexType OutputSimdWidth = SimdWidth / 4;
 #endif
+#if defined (USE_SSSE3)
+    // Whether the kernel processes a batch of inputs at once
+    static constexpr bool BatchKernel = OutputDimensions % OutputSimdWidth == 0;
+#else
+    static constexpr bool BatchKernel = false;
+#endif
 
     // Size of forward propagation buffer used in this layer
     static constexpr std::size_t SelfBufferSize =
@@ -55,6 +62,9 @@ namespace Stockfish::Eval::NNUE::Layers {
     static constexpr std::size_t BufferSize =
         PreviousLayer::BufferSize + SelfBufferSize;
 
+    // Position of the layer in the network, from the input layer
+    static constexpr IndexType LayerIndex = PreviousLayer::LayerIndex + 1;
+
     // Hash value embedded in the evaluation file
     static constexpr std::uint32_t get_hash_value() {
       std::uint32_t hashValue = 0xCC03DAE4u;
@@ -114,6 +124,33 @@ namespace Stockfish::Eval::NNUE::Layers {
         const TransformedFeatureType* transformedFeatures, char* buffer) const {
       const auto input = previousLayer.propagate(
           transformedFeatures, buffer + SelfBufferSize);
+      NNUE_STAGE_TIMER(StageLayers + LayerIndex - 1, "AffineTransform");
+      const auto output = reinterpret_cast<OutputType*>(buffer);
+      affine(input, output, 1, 0);
+      return output;
+    }
+
+    // Forward propagation of a batch of n inputs. The transformed features
+    // and the buffers of the inputs, and so the outputs, are 'stride' bytes apart.
+    const OutputType* propagate_batch(
+        const TransformedFeatureType* transformedFeatures, char* buffer,
+        IndexType n, std::size_t stride) const {
+      const auto input = previousLayer.propagate_batch(
+          transformedFeatures, buffer + SelfBufferSize, n, stride);
+      const auto output = reinterpret_cast<OutputType*>(buffer);
+      if constexpr (BatchKernel)
+        affine(input, output, n, stride);
+      else
+        for (IndexType i = 0; i < n; ++i)
+          affine(batch_at(input, i, stride), batch_at(output, i, stride), 1, 0);
+      return output;
+    }
+
+   private:
+    // Compute the outputs of n inputs, or of a single one without BatchKernel.
+    // Each column of weights is loaded once for all the inputs of a batch.
+    void affine(const InputType* input, OutputType* output,
+                [[maybe_unused]] IndexType n, [[maybe_unused]] std::size_t stride) const {
 
 #if defined (USE_AVX512)
 
@@ -254,7 +291,6 @@ namespace Stockfish::Eval::NNUE::Layers {
       // Different layout, we process 4 inputs at a time, always.
       static_assert(InputDimensions % 4 == 0);
 
-      const auto output = reinterpret_cast<OutputType*>(buffer);
       const auto inputVector = reinterpret_cast<const vec_t*>(input);
 
       static_assert(OutputDimensions % OutputSimdWidth == 0 || OutputDimensions == 1);
@@ -264,23 +300,33 @@ namespace Stockfish::Eval::NNUE::Layers {
       if constexpr (OutputDimensions % OutputSimdWidth == 0)
       {
           constexpr IndexType NumChunks = InputDimensions / 4;
+          constexpr IndexType NumRegs = OutputDimensions / OutputSimdWidth;
 
-          const auto input32 = reinterpret_cast<const std::int32_t*>(input);
-          vec_t* outptr = reinterpret_cast<vec_t*>(output);
-          std::memcpy(output, biases, OutputDimensions * sizeof(OutputType));
+          for (IndexType b = 0; b < n; ++b)
+              std::memcpy(batch_at(output, b, stride), biases, OutputDimensions * sizeof(OutputType));
 
           for (int i = 0; i < (int)NumChunks - 3; i += 4)
           {
-              const vec_t in0 = vec_set_32(input32[i + 0]);
-              const vec_t in1 = vec_set_32(input32[i + 1]);
-              const vec_t in2 = vec_set_32(input32[i + 2]);
-              const vec_t in3 = vec_set_32(input32[i + 3]);
               const auto col0 = reinterpret_cast<const vec_t*>(&weights[(i + 0) * OutputDimensions * 4]);
               const auto col1 = reinterpret_cast<const vec_t*>(&weights[(i + 1) * OutputDimensions * 4]);
               const auto col2 = reinterpret_cast<const vec_t*>(&weights[(i + 2) * OutputDimensions * 4]);
               const auto col3 = reinterpret_cast<const vec_t*>(&weights[(i + 3) * OutputDimensions * 4]);
-              for (int j = 0; j * OutputSimdWidth < OutputDimensions; ++j)
-                  vec_add_dpbusd_32x4(outptr[j], in0, col0[j], in1, col1[j], in2, col2[j], in3, col3[j]);
+
+              for (IndexType j = 0; j < NumRegs; ++j)
+              {
+                  const vec_t w0 = col0[j], w1 = col1[j], w2 = col2[j], w3 = col3[j];
+
+                  for (IndexType b = 0; b < n; ++b)
+                  {
+                      const auto input32 = reinterpret_cast<const std::int32_t*>(batch_at(input, b, stride));
+                      const auto outptr = reinterpret_cast<vec_t*>(batch_at(output, b, stride));
+                      const vec_t in0 = vec_set_32(input32[i + 0]);
+                      const vec_t in1 = vec_set_32(input32[i + 1]);
+                      const vec_t in2 = vec_set_32(input32[i + 2]);
+                      const vec_t in3 = vec_set_32(input32[i + 3]);
+                      vec_add_dpbusd_32x4(outptr[j], in0, w0, in1, w1, in2, w2, in3, w3);
+                  }
+              }
           }
       }
       else if constexpr (OutputDimensions == 1)
@@ -325,8 +371,6 @@ namespace Stockfish::Eval::NNUE::Layers {
 
 // Use old implementation for the other architectures.
 
-      auto output = reinterpret_cast<OutputType*>(buffer);
-
 #if defined(USE_SSE2)
       // At least a multiple of 16, with SSE2.
       static_assert(InputDimensions % SimdWidth == 0);
@@ -416,11 +460,8 @@ namespace Stockfish::Eval::NNUE::Layers {
 #endif
 
 #endif
-
-      return output;
     }
 
-   private:
     using BiasType = OutputType;
     using WeightType = std::int8_t;
 
@@ -430,6 +471,7 @@ namespace Stockfish::Eval::NNUE::Layers {
     alignas(CacheLineSize) WeightType weights[OutputDimensions * PaddedInputDimensions];
   };
 
+NNUE_VARIANT_END
 }  // namespace Stockfish::Eval::NNUE::Layers
 
 #endif // #ifndef NNUE_LAYERS_AFFINE_TRANSFORM_H_INCLUDED
@@ -0,0 +1,343 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2021 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Definition of layer AffineTransformSparseInput of NNUE evaluation function
+
+#ifndef NNUE_LAYERS_AFFINE_TRANSFORM_SPARSE_INPUT_H_INCLUDED
+#define NNUE_LAYERS_AFFINE_TRANSFORM_SPARSE_INPUT_H_INCLUDED
+
+#include <array>
+#include <iostream>
+#include "../nnue_common.h"
+#include "affine_transform.h"
+
+namespace Stockfish::Eval::NNUE::Layers {
+NNUE_VARIANT_BEGIN
+
+#if defined (USE_SSSE3)
+
+  // For each 8-bit mask, the positions of its set bits and their number. They
+  // turn the mask of the non-zero input chunks into a list of chunk indices.
+  constexpr auto make_lookup_indices() {
+    std::array<std::array<std::uint16_t, 8>, 256> v{};
+    for (int i = 0; i < 256; ++i)
+        for (int j = 0, k = 0; j < 8; ++j)
+            if (i & (1 << j))
+                v[i][k++] = std::uint16_t(j);
+    return v;
+  }
+
+  constexpr auto make_lookup_counts() {
+    std::array<std::uint8_t, 256> v{};
+    for (int i = 0; i < 256; ++i)
+        for (int j = 0; j < 8; ++j)
+            v[i] += bool(i & (1 << j));
+    return v;
+  }
+
+  alignas(CacheLineSize) constexpr auto LookupIndices = make_lookup_indices();
+  constexpr auto LookupCounts = make_lookup_counts();
+
+  // Affine transformation layer for an input where most of the values are zero,
+  // as the output of the feature transformer after clipping. Only the weights
+  // of the non-zero chunks of 4 inputs are accumulated. The weights are stored
+  // with the 4 bytes of each output for a chunk next to each other, so that the
+  // weights of a chunk for all the outputs are contiguous. Without VNNI, the
+  // dense layer adds the int16 products of the chunks 2k and 2k + 1 with
+  // saturation, so the pairs of non-zero chunks are accumulated the same way
+  // and the output is the same as the one of AffineTransform.
+  template <typename PreviousLayer, IndexType OutDims>
+  class AffineTransformSparseInput {
+   public:
+    // Input/output type
+    using InputType = typename PreviousLayer::OutputType;
+    using OutputType = std::int32_t;
+    static_assert(std::is_same<InputType, std::uint8_t>::value, "");
+
+    // Number of input/output dimensions
+    static constexpr IndexType InputDimensions =
+        PreviousLayer::OutputDimensions;
+    static constexpr IndexType OutputDimensions = OutDims;
+    static constexpr IndexType PaddedInputDimensions =
+        ceil_to_multiple<IndexType>(InputDimensions, MaxSimdWidth);
+
+    static_assert(InputDimensions % 64 == 0, "Pairs of chunks are looked for 8 at a time");
+
+    // Percentage of non-zero input chunks above which all the chunks are used
+    static constexpr IndexType SparseThreshold = 75;
+
+    // Size of forward propagation buffer used in this layer
+    static constexpr std::size_t SelfBufferSize =
+        ceil_to_multiple(OutputDimensions * sizeof(OutputType), CacheLineSize);
+
+    // Size of the forward propagation buffer used from the input layer to this layer
+    static constexpr std::size_t BufferSize =
+        PreviousLayer::BufferSize + SelfBufferSize;
+
+    // Position of the layer in the network, from the input layer
+    static constexpr IndexType LayerIndex = PreviousLayer::LayerIndex + 1;
+
+    // Hash value embedded in the evaluation file, the same as for the dense layer
+    static constexpr std::uint32_t get_hash_value() {
+      return AffineTransform<PreviousLayer, OutDims>::get_hash_value();
+    }
+
+    // Index of the i-th weight of the file in the chunk layout
+    static constexpr IndexType get_weight_index(IndexType i) {
+      return (i / 4) % (PaddedInputDimensions / 4) * OutputDimensions * 4 +
+             i / PaddedInputDimensions * 4 +
+             i % 4;
+    }
+
+    // Read network parameters
+    bool read_parameters(std::istream& stream) {
+      if (!previousLayer.read_parameters(stream)) return false;
+      for (std::size_t i = 0; i < OutputDimensions; ++i)
+        biases[i] = read_little_endian<BiasType>(stream);
+      for (std::size_t i = 0; i < OutputDimensions * PaddedInputDimensions; ++i)
+        weights[get_weight_index(IndexType(i))] = read_little_endian<WeightType>(stream);
+
+      return !stream.fail();
+    }
+
+    // Write network parameters
+    bool write_parameters(std::ostream& stream) const {
+      if (!previousLayer.write_parameters(stream)) return false;
+      for (std::size_t i = 0; i < OutputDimensions; ++i)
+        write_little_endian<BiasType>(stream, biases[i]);
+      for (std::size_t i = 0; i < OutputDimensions * PaddedInputDimensions; ++i)
+        write_little_endian<WeightType>(stream, weights[get_weight_index(IndexType(i))]);
+
+      return !stream.fail();
+    }
+
+    // Forward propagation
+    const OutputType* propagate(
+        const TransformedFeatureType* transformedFeatures, char* buffer) const {
+      const auto input = previousLayer.propagate(
+          transformedFeatures, buffer + SelfBufferSize);
+      NNUE_STAGE_TIMER(StageLayers + LayerIndex - 1, "AffineTransformSparseInput");
+
+#if defined (USE_AVX512)
+      using vec_t = __m512i;
+      auto vec_broadcast_32 = [](int a) { return _mm512_set1_epi32(a); };
+      [[maybe_unused]] const vec_t Ones = _mm512_set1_epi16(1);
+      auto vec_add_dpbusd_32x2 = [=](vec_t& acc, vec_t a0, vec_t b0, vec_t a1, vec_t b1) {
+  #if defined (USE_VNNI)
+        // Only the addition depends on the previous pair
+        vec_t product = _mm512_dpbusd_epi32(_mm512_setzero_si512(), a0, b0);
+        acc = _mm512_add_epi32(acc, _mm512_dpbusd_epi32(product, a1, b1));
+  #else
+        vec_t product = _mm512_adds_epi16(_mm512_maddubs_epi16(a0, b0), _mm512_maddubs_epi16(a1, b1));
+        acc = _mm512_add_epi32(acc, _mm512_madd_epi16(product, Ones));
+  #endif
+      };
+      [[maybe_unused]] auto vec_add_dpbusd_32x2_wide = [=](vec_t& acc, vec_t a0, vec_t b0, vec_t a1, vec_t b1) {
+        vec_t product0 = _mm512_madd_epi16(_mm512_maddubs_epi16(a0, b0), Ones);
+        vec_t product1 = _mm512_madd_epi16(_mm512_maddubs_epi16(a1, b1), Ones);
+        acc = _mm512_add_epi32(acc, _mm512_add_epi32(product0, product1));
+      };
+#elif defined (USE_AVX2)
+      using vec_t = __m256i;
+      auto vec_broadcast_32 = [](int a) { return _mm256_set1_epi32(a); };
+      [[maybe_unused]] const vec_t Ones = _mm256_set1_epi16(1);
+      auto vec_add_dpbusd_32x2 = [=](vec_t& acc, vec_t a0, vec_t b0, vec_t a1, vec_t b1) {
+  #if defined (USE_VNNI)
+        // Only the addition depends on the previous pair
+        vec_t product = _mm256_dpbusd_epi32(_mm256_setzero_si256(), a0, b0);
+        acc = _mm256_add_epi32(acc, _mm256_dpbusd_epi32(product, a1, b1));
+  #else
+        vec_t product = _mm256_adds_epi16(_mm256_maddubs_epi16(a0, b0), _mm256_maddubs_epi16(a1, b1));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(product, Ones));
+  #endif
+      };
+      [[maybe_unused]] auto vec_add_dpbusd_32x2_wide = [=](vec_t& acc, vec_t a0, vec_t b0, vec_t a1, vec_t b1) {
+        vec_t product0 = _mm256_madd_epi16(_mm256_maddubs_epi16(a0, b0), Ones);
+        vec_t product1 = _mm256_madd_epi16(_mm256_maddubs_epi16(a1, b1), Ones);
+        acc = _mm256_add_epi32(acc, _mm256_add_epi32(product0, product1));
+      };
+#else
+      using vec_t = __m128i;
+      auto vec_broadcast_32 = [](int a) { return _mm_set1_epi32(a); };
+      const vec_t Ones = _mm_set1_epi16(1);
+      auto vec_add_dpbusd_32x2 = [=](vec_t& acc, vec_t a0, vec_t b0, vec_t a1, vec_t b1) {
+        vec_t product = _mm_adds_epi16(_mm_maddubs_epi16(a0, b0), _mm_maddubs_epi16(a1, b1));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(product, Ones));
+      };
+      auto vec_add_dpbusd_32x2_wide = [=](vec_t& acc, vec_t a0, vec_t b0, vec_t a1, vec_t b1) {
+        vec_t product0 = _mm_madd_epi16(_mm_maddubs_epi16(a0, b0), Ones);
+        vec_t product1 = _mm_madd_epi16(_mm_maddubs_epi16(a1, b1), Ones);
+        acc = _mm_add_epi32(acc, _mm_add_epi32(product0, product1));
+      };
+#endif
+
+      constexpr IndexType NumChunks = InputDimensions / 4;
+      constexpr IndexType NumRegs = OutputDimensions * sizeof(OutputType) / sizeof(vec_t);
+      static_assert(OutputDimensions * sizeof(OutputType) % sizeof(vec_t) == 0);
+
+      const auto input32 = reinterpret_cast<const std::int32_t*>(input);
+
+      // Mask of the chunks of 4 inputs from i to i + 7 that are not all zero. The
+      // inputs are at most 127, so a chunk is positive as an int32 if not zero.
+      auto chunk_mask = [&](IndexType i) -> unsigned {
+#if defined (USE_AVX2)
+          const __m256i in = _mm256_load_si256(reinterpret_cast<const __m256i*>(&input32[i]));
+          return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(in, _mm256_setzero_si256())));
+#else
+          const __m128i in0 = _mm_load_si128(reinterpret_cast<const __m128i*>(&input32[i]));
+          const __m128i in1 = _mm_load_si128(reinterpret_cast<const __m128i*>(&input32[i + 4]));
+          return  _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(in0, _mm_setzero_si128())))
+                | (_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(in1, _mm_setzero_si128()))) << 4);
+#endif
+      };
+
+      // Appends to list the indices of the set bits of an 8-bit mask, plus
+      // base. A full lookup entry is stored each time, hence the padding.
+      auto add_indices = [&](std::uint16_t* list, IndexType& n, unsigned mask, __m128i base) {
+          const __m128i offsets = _mm_load_si128(reinterpret_cast<const __m128i*>(&LookupIndices[mask]));
+          _mm_storeu_si128(reinterpret_cast<__m128i*>(&list[n]), _mm_add_epi16(base, offsets));
+          n += LookupCounts[mask];
+      };
+
+      // Find the indices of the chunks that are not all zero. Without VNNI, the
+      // pairs (2k, 2k + 1) of such chunks go to their own list instead.
+      std::uint16_t nnz[NumChunks + 8];
+      [[maybe_unused]] std::uint16_t pairs[NumChunks / 2 + 8];
+      IndexType count = 0, pairCount = 0;
+      const __m128i Increment = _mm_set1_epi16(8);
+      __m128i base = _mm_setzero_si128();
+
+#if defined (USE_VNNI)
+      for (IndexType i = 0; i < NumChunks; i += 8)
+      {
+          add_indices(nnz, count, chunk_mask(i), base);
+          base = _mm_add_epi16(base, Increment);
+      }
+#else
+      __m128i pairBase = _mm_setzero_si128();
+
+      for (IndexType i = 0; i < NumChunks; i += 16)
+      {
+          const unsigned mask = chunk_mask(i) | chunk_mask(i + 8) << 8;
+
+          // One bit per pair with both chunks non-zero, at the even positions
+          unsigned both = mask & mask >> 1 & 0x5555;
+          const unsigned lone = mask & ~(both | both << 1);
+
+          both = (both | both >> 1) & 0x3333;
+          both = (both | both >> 2) & 0x0F0F;
+          both = (both | both >> 4) & 0x00FF;
+
+          add_indices(pairs, pairCount, both, pairBase);
+          add_indices(nnz, count, lone & 0xFF, base);
+          add_indices(nnz, count, lone >> 8, _mm_add_epi16(base, Increment));
+          base = _mm_add_epi16(base, _mm_add_epi16(Increment, Increment));
+          pairBase = _mm_add_epi16(pairBase, Increment);
+      }
+#endif
+
+      // Accumulate the weights of these chunks for all the outputs
+      const auto output = reinterpret_cast<OutputType*>(buffer);
+      const auto biasvec = reinterpret_cast<const vec_t*>(biases);
+      const auto outptr = reinterpret_cast<vec_t*>(output);
+      vec_t acc[NumRegs];
+
+      for (IndexType k = 0; k < NumRegs; ++k)
+          acc[k] = biasvec[k];
+
+      auto accumulate = [&](IndexType i0, IndexType i1, vec_t in1) {
+          const vec_t in0 = vec_broadcast_32(input32[i0]);
+          const auto col0 = reinterpret_cast<const vec_t*>(&weights[i0 * OutputDimensions * 4]);
+          const auto col1 = reinterpret_cast<const vec_t*>(&weights[i1 * OutputDimensions * 4]);
+          for (IndexType k = 0; k < NumRegs; ++k)
+              vec_add_dpbusd_32x2(acc[k], in0, col0[k], in1, col1[k]);
+      };
+
+      // Two chunks at a time. When few chunks are zero, it is faster to go
+      // through all of them than to load their indices.
+      if (count + 2 * pairCount > NumChunks * SparseThreshold / 100)
+          for (IndexType i = 0; i < NumChunks; i += 2)
+              accumulate(i, i + 1, vec_broadcast_32(input32[i + 1]));
+      else
+      {
+#if defined (USE_VNNI)
+          // An odd count is completed with a zero chunk
+          nnz[count] = 0;
+          for (IndexType j = 0; j < count; j += 2)
+              accumulate(nnz[j], nnz[j + 1], j + 1 < count ? vec_broadcast_32(input32[nnz[j + 1]])
+                                                           : vec_broadcast_32(0));
+#else
+          for (IndexType j = 0; j < pairCount; ++j)
+              accumulate(2 * pairs[j], 2 * pairs[j] + 1, vec_broadcast_32(input32[2 * pairs[j] + 1]));
+
+          // The other chunk of the pair is zero, so the saturating addition
+          // of the dense layer would leave the products unchanged. These chunks
+          // are from different pairs, so they are added as int32 like in the
+          // dense layer, two at a time. An odd count is completed with a zero chunk.
+          nnz[count] = 0;
+          for (IndexType j = 0; j < count; j += 2)
+          {
+              const vec_t in0 = vec_broadcast_32(input32[nnz[j]]);
+              const vec_t in1 = j + 1 < count ? vec_broadcast_32(input32[nnz[j + 1]]) : vec_broadcast_32(0);
+              const auto col0 = reinterpret_cast<const vec_t*>(&weights[nnz[j] * OutputDimensions * 4]);
+              const auto col1 = reinterpret_cast<const vec_t*>(&weights[nnz[j + 1] * OutputDimensions * 4]);
+              for (IndexType k = 0; k < NumRegs; ++k)
+                  vec_add_dpbusd_32x2_wide(acc[k], in0, col0[k], in1, col1[k]);
+          }
+#endif
+      }
+
+      for (IndexType k = 0; k < NumRegs; ++k)
+          outptr[k] = acc[k];
+
+      return output;
+    }
+
+    // Forward propagation of a batch of n inputs, 'stride' bytes apart. Each
+    // input goes through its own non-zero chunks: the union of these chunks
+    // for the batch is close to all of them.
+    const OutputType* propagate_batch(
+        const TransformedFeatureType* transformedFeatures, char* buffer,
+        IndexType n, std::size_t stride) const {
+      for (IndexType i = 0; i < n; ++i)
+          propagate(batch_at(transformedFeatures, i, stride), batch_at(buffer, i, stride));
+      return reinterpret_cast<OutputType*>(buffer);
+    }
+
+   private:
+    using BiasType = OutputType;
+    using WeightType = std::int8_t;
+
+    PreviousLayer previousLayer;
+
+    alignas(CacheLineSize) BiasType biases[OutputDimensions];
+    alignas(CacheLineSize) WeightType weights[OutputDimensions * PaddedInputDimensions];
+  };
+
+#else
+
+  // Without SSSE3 there is no sparse kernel, the dense layer is used instead
+  template <typename PreviousLayer, IndexType OutDims>
+  using AffineTransformSparseInput = AffineTransform<PreviousLayer, OutDims>;
+
+#endif
+
+NNUE_VARIANT_END
+}  // namespace Stockfish::Eval::NNUE::Layers
+
+#endif // #ifndef NNUE_LAYERS_AFFINE_TRANSFORM_SPARSE_INPUT_H_INCLUDED
@@ -24,6 +24,7 @@
 #include "../nnue_common.h"
 
 namespace Stockfish::Eval::NNUE::Layers {
+NNUE_VARIANT_BEGIN
 
   // Clipped ReLU
   template <typename PreviousLayer>
@@ -47,6 +48,9 @@ namespace Stockfish::Eval::NNUE::Layers {
     static constexpr std::size_t BufferSize =
         PreviousLayer::BufferSize + SelfBufferSize;
 
+    // Position of the layer in the network, from the input layer
+    static constexpr IndexType LayerIndex = PreviousLayer::LayerIndex + 1;
+
     // Hash value embedded in the evaluation file
     static constexpr std::uint32_t get_hash_value() {
       std::uint32_t hashValue = 0x538D24C7u;
@@ -69,7 +73,27 @@ namespace Stockfish::Eval::NNUE::Layers {
         const TransformedFeatureType* transformedFeatures, char* buffer) const {
       const auto input = previousLayer.propagate(
           transformedFeatures, buffer + SelfBufferSize);
+      NNUE_STAGE_TIMER(StageLayers + LayerIndex - 1, "ClippedReLU");
       const auto output = reinterpret_cast<OutputType*>(buffer);
+      clip(input, output);
+      return output;
+    }
+
+    // Forward propagation of a batch of n inputs. The transformed features
+    // and the buffers of the inputs, and so the outputs, are 'stride' bytes apart.
+    const OutputType* propagate_batch(
+        const TransformedFeatureType* transformedFeatures, char* buffer,
+        IndexType n, std::size_t stride) const {
+      const auto input = previousLayer.propagate_batch(
+          transformedFeatures, buffer + SelfBufferSize, n, stride);
+      const auto output = reinterpret_cast<OutputType*>(buffer);
+      for (IndexType i = 0; i < n; ++i)
+        clip(batch_at(input, i, stride), batch_at(output, i, stride));
+      return output;
+    }
+
+   private:
+    void clip(const InputType* input, OutputType* output) const {
 
   #if defined(USE_AVX2)
       if constexpr (InputDimensions % SimdWidth == 0) {
@@ -179,13 +203,12 @@ namespace Stockfish::Eval::NNUE::Layers {
         output[i] = static_cast<OutputType>(
             std::max(0, std::min(127, input[i] >> WeightScaleBits)));
       }
-      return output;
     }
 
-   private:
     PreviousLayer previousLayer;
   };
 
+NNUE_VARIANT_END
 }  // namespace Stockfish::Eval::NNUE::Layers
 
 #endif // NNUE_LAYERS_CLIPPED_RELU_H_INCLUDED
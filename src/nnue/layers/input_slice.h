@@ -24,6 +24,7 @@
 #include "../nnue_common.h"
 
 namespace Stockfish::Eval::NNUE::Layers {
+NNUE_VARIANT_BEGIN
 
 // Input layer
 template <IndexType OutDims, IndexType Offset = 0>
@@ -41,6 +42,9 @@ class InputSlice {
   // Size of forward propagation buffer used from the input layer to this layer
   static constexpr std::size_t BufferSize = 0;
 
+  // Position of the layer in the network, from the input layer
+  static constexpr IndexType LayerIndex = 0;
+
   // Hash value embedded in the evaluation file
   static constexpr std::uint32_t get_hash_value() {
     std::uint32_t hashValue = 0xEC42E90Du;
@@ -65,9 +69,17 @@ class InputSlice {
     return transformedFeatures + Offset;
   }
 
+  // Forward propagation of a batch
+  const OutputType* propagate_batch(
+      const TransformedFeatureType* transformedFeatures,
+      char* /*buffer*/, IndexType /*n*/, std::size_t /*stride*/) const {
+    return transformedFeatures + Offset;
+  }
+
  private:
 };
 
+NNUE_VARIANT_END
 }  // namespace Stockfish::Eval::NNUE::Layers
 
 #endif // #ifndef NNUE_LAYERS_INPUT_SLICE_H_INCLUDED
@@ -21,15 +21,163 @@
 #ifndef NNUE_ACCUMULATOR_H_INCLUDED
 #define NNUE_ACCUMULATOR_H_INCLUDED
 
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
 #include "nnue_architecture.h"
 
+namespace Stockfish {
+  struct StateInfo;
+}
+
 namespace Stockfish::Eval::NNUE {
 
-  // Class that holds the result of affine transformation of input features
+  // Class that holds the result of affine transformation of input features.
+  // The accumulation of each perspective has the width of the loaded net and
+  // is stored by the AccumulatorStack. The accumulator is only valid for the
+  // state it was last claimed by.
   struct alignas(CacheLineSize) Accumulator {
-    std::int16_t accumulation[2][TransformedFeatureDimensions];
     std::int32_t psqtAccumulation[2][PSQTBuckets];
+    std::int16_t* accumulation[2];
     bool computed[2];
+    const StateInfo* state;
+
+    void claim(const StateInfo* st) {
+      if (state != st)
+      {
+        state = st;
+        computed[WHITE] = computed[BLACK] = false;
+      }
+    }
+  };
+
+  // Ring of accumulators of a thread, one for each ply of the line being
+  // searched. A state gets the slot after the one of its previous state, so
+  // that the accumulators of a line are contiguous in memory, and the slots
+  // wrap around once deeper than any search can go. The states of the game
+  // history, which are shared by all the threads, thus carry no accumulator
+  // data themselves. The slots, followed by their accumulations, are allocated
+  // in large pages when possible, when the first position is set up with the
+  // width of the loaded net.
+  class AccumulatorStack {
+
+    static constexpr int Size = MAX_PLY + 10;
+
+  public:
+    AccumulatorStack() = default;
+   ~AccumulatorStack() { aligned_large_pages_free(slots); }
+
+    AccumulatorStack(const AccumulatorStack&) = delete;
+    AccumulatorStack& operator=(const AccumulatorStack&) = delete;
+
+    bool owns(const Accumulator* acc) const { return slots && acc >= slots && acc < slots + Size; }
+
+    // Width of the accumulations, the one of the net loaded when the slots
+    // were allocated
+    IndexType width() const { return accWidth; }
+
+    // Slot of the state of a position just set up. The slots are allocated
+    // again if a net of another width has been loaded since the last position,
+    // the states of the positions set up before then no longer own a slot.
+    Accumulator* root(const StateInfo* st, IndexType netWidth) {
+      if (netWidth != accWidth)
+          resize(netWidth);
+      return assign(slots, st);
+    }
+
+    // Slot of a state following the one with the given slot
+    Accumulator* next(Accumulator* acc, const StateInfo* st) {
+      return assign(owns(acc) && acc + 1 < slots + Size ? acc + 1 : slots, st);
+    }
+
+  private:
+    static Accumulator* assign(Accumulator* acc, const StateInfo* st) {
+      acc->state = st;
+      acc->computed[WHITE] = acc->computed[BLACK] = false;
+      return acc;
+    }
+
+    void resize(IndexType netWidth) {
+      const std::size_t size = Size * (sizeof(Accumulator) + 2 * netWidth * sizeof(std::int16_t));
+
+      aligned_large_pages_free(slots);
+      slots = static_cast<Accumulator*>(aligned_large_pages_alloc(size));
+      if (!slots)
+      {
+          std::cerr << "Failed to allocate the NNUE accumulators" << std::endl;
+          std::exit(EXIT_FAILURE);
+      }
+      std::memset(static_cast<void*>(slots), 0, size);
+
+      std::int16_t* accumulation = reinterpret_cast<std::int16_t*>(slots + Size);
+      for (int i = 0; i < Size; ++i)
+          for (Color c : { WHITE, BLACK })
+              slots[i].accumulation[c] = accumulation + (2 * i + c) * netWidth;
+
+      accWidth = netWidth;
+    }
+
+    Accumulator* slots = nullptr;
+    IndexType accWidth = 0;
+  };
+
+  // Class that keeps, for each king square and perspective, the accumulator of
+  // the last refresh with the king on that square, together with the pieces it
+  // was computed from (the so-called Finny tables). A refresh then only has to
+  // apply the difference between these pieces and the ones of the position.
+  class AccumulatorCaches {
+
+  public:
+    struct alignas(CacheLineSize) Entry {
+      std::int32_t psqtAccumulation[PSQTBuckets];
+      Bitboard byColorBB[COLOR_NB];
+      Bitboard byTypeBB[PIECE_TYPE_NB];
+      std::int16_t* accumulation;
+    };
+
+    AccumulatorCaches() = default;
+   ~AccumulatorCaches() { std_aligned_free(accumulations); }
+
+    AccumulatorCaches(const AccumulatorCaches&) = delete;
+    AccumulatorCaches& operator=(const AccumulatorCaches&) = delete;
+
+    // Entries are only valid for the net they were computed with
+    void clear() { netId = 0; }
+
+    // Whether the entries must be reset for the net with the given id, which
+    // is not the one they were computed with. Their accumulations are then
+    // allocated again if the net has another width.
+    bool reset(std::uint32_t id, IndexType netWidth) {
+      if (id == netId)
+          return false;
+
+      if (netWidth != accWidth)
+      {
+          std_aligned_free(accumulations);
+          accumulations = static_cast<std::int16_t*>(
+            std_aligned_alloc(CacheLineSize, SQUARE_NB * COLOR_NB * netWidth * sizeof(std::int16_t)));
+          if (!accumulations)
+          {
+              std::cerr << "Failed to allocate the NNUE accumulator caches" << std::endl;
+              std::exit(EXIT_FAILURE);
+          }
+          for (Square s = SQ_A1; s <= SQ_H8; ++s)
+              for (Color c : { WHITE, BLACK })
+                  entries[s][c].accumulation = accumulations + (2 * s + c) * netWidth;
+          accWidth = netWidth;
+      }
+
+      netId = id;
+      return true;
+    }
+
+    Entry entries[SQUARE_NB][COLOR_NB];
+
+  private:
+    std::int16_t* accumulations = nullptr;
+    IndexType accWidth = 0;
+    std::uint32_t netId = 0;
   };
 
 }  // namespace Stockfish::Eval::NNUE
@@ -21,40 +21,60 @@
 #ifndef NNUE_ARCHITECTURE_H_INCLUDED
 #define NNUE_ARCHITECTURE_H_INCLUDED
 
+#include <utility>
+
 #include "nnue_common.h"
 
 #include "features/half_ka_v2.h"
 
 #include "layers/input_slice.h"
 #include "layers/affine_transform.h"
+#include "layers/affine_transform_sparse_input.h"
 #include "layers/clipped_relu.h"
 
 namespace Stockfish::Eval::NNUE {
+NNUE_VARIANT_BEGIN
 
   // Input features used in evaluation function
   using FeatureSet = Features::HalfKAv2;
 
-  // Number of input feature dimensions after conversion
-  constexpr IndexType TransformedFeatureDimensions = 512;
+  // Number of input feature dimensions after conversion, for one perspective.
+  // Nets of any of these widths can be loaded, each width with its own
+  // instantiation of the feature transformer and of the network, the one of
+  // a net being found from the hash value in its header. The default width
+  // is the one of the embedded net.
+  using TransformedFeatureWidths = std::integer_sequence<IndexType, 256, 512, 1024>;
+  constexpr IndexType DefaultTransformedFeatureDimensions = 512;
+  constexpr IndexType MaxTransformedFeatureDimensions = 1024;
   constexpr IndexType PSQTBuckets = 8;
   constexpr IndexType LayerStacks = 8;
 
+NNUE_VARIANT_END
+
   namespace Layers {
+  NNUE_VARIANT_BEGIN
 
     // Define network structure
-    using InputLayer = InputSlice<TransformedFeatureDimensions * 2>;
-    using HiddenLayer1 = ClippedReLU<AffineTransform<InputLayer, 16>>;
-    using HiddenLayer2 = ClippedReLU<AffineTransform<HiddenLayer1, 32>>;
-    using OutputLayer = AffineTransform<HiddenLayer2, 1>;
-
+    template <IndexType TransformedFeatureDimensions>
+    struct NetworkStructure {
+      using InputLayer = InputSlice<TransformedFeatureDimensions * 2>;
+      using HiddenLayer1 = ClippedReLU<AffineTransformSparseInput<InputLayer, 16>>;
+      using HiddenLayer2 = ClippedReLU<AffineTransform<HiddenLayer1, 32>>;
+      using OutputLayer = AffineTransform<HiddenLayer2, 1>;
+    };
+
+  NNUE_VARIANT_END
   }  // namespace Layers
 
-  using Network = Layers::OutputLayer;
+NNUE_VARIANT_BEGIN
+
+  template <IndexType TransformedFeatureDimensions>
+  using Network = typename Layers::NetworkStructure<TransformedFeatureDimensions>::OutputLayer;
 
-  static_assert(TransformedFeatureDimensions % MaxSimdWidth == 0, "");
-  static_assert(Network::OutputDimensions == 1, "");
-  static_assert(std::is_same<Network::OutputType, std::int32_t>::value, "");
+  static_assert(Network<DefaultTransformedFeatureDimensions>::OutputDimensions == 1, "");
+  static_assert(std::is_same<Network<DefaultTransformedFeatureDimensions>::OutputType, std::int32_t>::value, "");
 
+NNUE_VARIANT_END
 }  // namespace Stockfish::Eval::NNUE
 
 #endif // #ifndef NNUE_ARCHITECTURE_H_INCLUDED
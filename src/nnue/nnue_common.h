@@ -21,10 +21,13 @@
 #ifndef NNUE_COMMON_H_INCLUDED
 #define NNUE_COMMON_H_INCLUDED
 
+#include <algorithm>
 #include <cstring>
 #include <iostream>
+#include <string_view>
 
 #include "../misc.h"  // for IsLittleEndian
+#include "nnue_stats.h"
 
 #if defined(USE_AVX2)
 #include <immintrin.h>
@@ -45,7 +48,19 @@
 #include <arm_neon.h>
 #endif
 
+// The NNUE code of a dispatch build is compiled once for each instruction set
+// level, with NNUE_VARIANT naming the level. The variants are kept apart in
+// inline namespaces, so that the code refers to the same names in all of them.
+#if defined(NNUE_VARIANT)
+#define NNUE_VARIANT_BEGIN inline namespace NNUE_VARIANT {
+#define NNUE_VARIANT_END }
+#else
+#define NNUE_VARIANT_BEGIN
+#define NNUE_VARIANT_END
+#endif
+
 namespace Stockfish::Eval::NNUE {
+NNUE_VARIANT_BEGIN
 
   // Version of the evaluation file
   constexpr std::uint32_t Version = 0x7AF32F20u;
@@ -73,6 +88,9 @@ namespace Stockfish::Eval::NNUE {
 
   constexpr std::size_t MaxSimdWidth = 32;
 
+  // Number of positions propagated together by evaluate_batch()
+  constexpr std::size_t MaxBatchSize = 16;
+
   // Type of input feature after conversion
   using TransformedFeatureType = std::uint8_t;
   using IndexType = std::uint32_t;
@@ -83,6 +101,13 @@ namespace Stockfish::Eval::NNUE {
       return (n + base - 1) / base * base;
   }
 
+  // Address of the i-th object of a batch where the objects are 'stride' bytes apart
+  template <typename T>
+  constexpr T* batch_at(T* first, IndexType i, std::size_t stride) {
+      using Byte = std::conditional_t<std::is_const_v<T>, const char, char>;
+      return reinterpret_cast<T*>(reinterpret_cast<Byte*>(first) + i * stride);
+  }
+
   // read_little_endian() is our utility to read an integer (signed or unsigned, any size)
   // from a stream in little-endian order. We swap the byte order after the read if
   // necessary to return a result with the byte ordering of the compiling machine.
@@ -159,6 +184,143 @@ namespace Stockfish::Eval::NNUE {
               write_little_endian<IntType>(stream, values[i]);
   }
 
+  // Compressed nets store the parameters of the feature transformer in the
+  // signed LEB128 encoding: seven bits per byte, the high bit telling if more
+  // bytes follow. Most int16 weights then take a single byte. An encoded array
+  // starts with a magic string and the size in bytes of the encoded values.
+  constexpr std::string_view Leb128MagicString("COMPRESSED_LEB128");
+
+  // read_leb_128(s, out, N) : read N integers encoded in LEB128 from stream s,
+  // decoding them straight into array out through a small buffer.
+  template <typename IntType>
+  inline void read_leb_128(std::istream& stream, IntType* out, std::size_t count) {
+
+      static_assert(std::is_signed_v<IntType>, "Not implemented for unsigned types");
+      using UIntType = std::make_unsigned_t<IntType>;
+
+      char magic[Leb128MagicString.size()];
+      stream.read(magic, sizeof(magic));
+      if (!stream || std::string_view(magic, sizeof(magic)) != Leb128MagicString)
+      {
+          stream.setstate(std::ios::failbit);
+          return;
+      }
+
+      // The buffer is refilled before it may run out in the middle of a value
+      constexpr std::uint32_t BufSize = 4096;
+      constexpr std::uint32_t MaxBytes = (sizeof(IntType) * 8 + 6) / 7;
+      char buf[BufSize];
+      std::uint32_t bytesLeft = read_little_endian<std::uint32_t>(stream);
+      std::uint32_t bufPos = 0, bufEnd = 0;
+
+      for (std::size_t i = 0; i < count; ++i)
+      {
+          if (bufEnd - bufPos < MaxBytes && bytesLeft)
+          {
+              std::memmove(buf, buf + bufPos, bufEnd - bufPos);
+              bufEnd -= bufPos;
+              bufPos = 0;
+
+              const std::uint32_t n = std::min(bytesLeft, BufSize - bufEnd);
+              stream.read(buf + bufEnd, n);
+              bufEnd += n;
+              bytesLeft -= n;
+          }
+
+          if (bufPos == bufEnd || !stream)
+          {
+              stream.setstate(std::ios::failbit);
+              return;
+          }
+
+          // Most values fit in a single byte
+          std::uint8_t byte = std::uint8_t(buf[bufPos++]);
+          if (!(byte & 0x80))
+          {
+              out[i] = IntType(std::int8_t(byte << 1) >> 1);
+              continue;
+          }
+
+          UIntType result = UIntType(byte & 0x7f);
+          std::size_t shift = 7;
+
+          do {
+              if (bufPos == bufEnd)
+              {
+                  stream.setstate(std::ios::failbit);
+                  return;
+              }
+
+              byte = std::uint8_t(buf[bufPos++]);
+              result |= UIntType(byte & 0x7f) << shift;
+              shift += 7;
+          } while ((byte & 0x80) && shift < sizeof(IntType) * 8);
+
+          // Sign extend from the last byte
+          if (shift < sizeof(IntType) * 8 && (byte & 0x40))
+              result |= UIntType(UIntType(-1) << shift);
+
+          out[i] = IntType(result);
+      }
+
+      if (bytesLeft || bufPos != bufEnd)
+          stream.setstate(std::ios::failbit);
+  }
+
+  // write_leb_128(s, values, N) : write N integers from array values on stream s,
+  // encoded in LEB128.
+  template <typename IntType>
+  inline void write_leb_128(std::ostream& stream, const IntType* values, std::size_t count) {
+
+      static_assert(std::is_signed_v<IntType>, "Not implemented for unsigned types");
+
+      // Size of the encoding of a value
+      auto size = [](IntType value) {
+          std::uint32_t n = 0;
+          std::uint8_t byte;
+          do {
+              byte = value & 0x7f;
+              value >>= 7;
+              ++n;
+          } while ((byte & 0x40) == 0 ? value != 0 : value != -1);
+          return n;
+      };
+
+      std::uint32_t byteCount = 0;
+      for (std::size_t i = 0; i < count; ++i)
+          byteCount += size(values[i]);
+
+      stream.write(Leb128MagicString.data(), Leb128MagicString.size());
+      write_little_endian<std::uint32_t>(stream, byteCount);
+
+      constexpr std::uint32_t BufSize = 4096;
+      std::uint8_t buf[BufSize];
+      std::uint32_t bufPos = 0;
+
+      for (std::size_t i = 0; i < count; ++i)
+      {
+          IntType value = values[i];
+          std::uint8_t byte;
+
+          do {
+              byte = value & 0x7f;
+              value >>= 7;
+              if ((byte & 0x40) == 0 ? value != 0 : value != -1)
+                  byte |= 0x80;
+
+              buf[bufPos++] = byte;
+              if (bufPos == BufSize)
+              {
+                  stream.write(reinterpret_cast<const char*>(buf), BufSize);
+                  bufPos = 0;
+              }
+          } while (byte & 0x80);
+      }
+
+      stream.write(reinterpret_cast<const char*>(buf), bufPos);
+  }
+
+NNUE_VARIANT_END
 }  // namespace Stockfish::Eval::NNUE
 
 #endif // #ifndef NNUE_COMMON_H_INCLUDED
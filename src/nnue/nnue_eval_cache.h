@@ -0,0 +1,121 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2021 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Cache of the NNUE evaluations of a thread
+
+#ifndef NNUE_EVAL_CACHE_H_INCLUDED
+#define NNUE_EVAL_CACHE_H_INCLUDED
+
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "../types.h"
+#include "nnue_common.h"
+
+namespace Stockfish::Eval::NNUE {
+
+  // Hash table from the position key to the NNUE evaluation. In search, the
+  // same positions are often evaluated again, when their transposition table
+  // entry has been overwritten or in re-searches. Each bucket fills a cache
+  // line, and its entries are replaced in turn. The size is given in MB, and
+  // 0 disables the cache.
+  class EvalCache {
+
+    static constexpr int BucketSize = 10;
+
+    struct alignas(CacheLineSize) Bucket {
+      std::uint32_t keys[BucketSize];
+      std::int16_t values[BucketSize];
+      std::uint8_t next;
+    };
+
+    static_assert(sizeof(Bucket) == CacheLineSize, "Unexpected Bucket size");
+
+  public:
+    // Allocate the table if the size changed, then empty it
+    void resize(std::size_t mbSize) {
+
+      const std::size_t count = mbSize * 1024 * 1024 / sizeof(Bucket);
+
+      if (count != table.size())
+          table = std::vector<Bucket>(count);
+
+      clear();
+    }
+
+    // Entries are only valid for the net they were computed with
+    void clear() {
+      if (!table.empty())
+          std::memset(static_cast<void*>(table.data()), 0, table.size() * sizeof(Bucket));
+      netId = 0;
+    }
+
+    bool probe(Key key, std::uint32_t id, Value& v) {
+
+      if (table.empty())
+          return false;
+
+      if (netId != id)
+      {
+          clear();
+          netId = id;
+      }
+
+      ++probes;
+      const Bucket& b = bucket(key);
+
+      for (int i = 0; i < BucketSize; ++i)
+          if (b.keys[i] == std::uint32_t(key >> 32))
+          {
+              ++hits;
+              v = Value(b.values[i]);
+              return true;
+          }
+
+      return false;
+    }
+
+    void store(Key key, Value v) {
+
+      if (   table.empty()
+          || v < std::numeric_limits<std::int16_t>::min()
+          || v > std::numeric_limits<std::int16_t>::max())
+          return;
+
+      Bucket& b = bucket(key);
+      b.keys[b.next] = std::uint32_t(key >> 32);
+      b.values[b.next] = std::int16_t(v);
+      b.next = std::uint8_t((b.next + 1) % BucketSize);
+    }
+
+    // Statistics of the current search
+    std::uint64_t probes = 0, hits = 0;
+
+  private:
+    Bucket& bucket(Key key) {
+      return table[(std::uint64_t(std::uint32_t(key)) * table.size()) >> 32];
+    }
+
+    std::vector<Bucket> table;
+    std::uint32_t netId = 0;
+  };
+
+}  // namespace Stockfish::Eval::NNUE
+
+#endif // NNUE_EVAL_CACHE_H_INCLUDED
@@ -23,10 +23,12 @@
 
 #include "nnue_common.h"
 #include "nnue_architecture.h"
+#include "nnue_accumulator.h"
 
 #include <cstring> // std::memset()
 
 namespace Stockfish::Eval::NNUE {
+NNUE_VARIANT_BEGIN
 
   using BiasType       = std::int16_t;
   using WeightType     = std::int16_t;
@@ -154,23 +156,36 @@ namespace Stockfish::Eval::NNUE {
           return 1;
       }
 
-      static constexpr int NumRegs     = BestRegisterCount<vec_t, WeightType, TransformedFeatureDimensions, NumRegistersSIMD>();
       static constexpr int NumPsqtRegs = BestRegisterCount<psqt_vec_t, PSQTWeightType, PSQTBuckets, NumRegistersSIMD>();
 
       #pragma GCC diagnostic pop
 
   #endif
 
+  // Id of a newly loaded net, shared by the nets of all the widths
+  inline std::uint32_t new_net_id() {
+    static std::uint32_t loads = 0;
+    return ++loads;
+  }
 
 
   // Input feature converter
+  template <IndexType TransformedFeatureDimensions>
   class FeatureTransformer {
 
    private:
     // Number of output dimensions for one side
     static constexpr IndexType HalfDimensions = TransformedFeatureDimensions;
 
+    static_assert(HalfDimensions % MaxSimdWidth == 0, "");
+    static_assert(HalfDimensions <= MaxTransformedFeatureDimensions, "");
+
     #ifdef VECTOR
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wignored-attributes"
+    static constexpr int NumRegs = BestRegisterCount<vec_t, WeightType, HalfDimensions, NumRegistersSIMD>();
+    #pragma GCC diagnostic pop
+
     static constexpr IndexType TileHeight = NumRegs * sizeof(vec_t) / 2;
     static constexpr IndexType PsqtTileHeight = NumPsqtRegs * sizeof(psqt_vec_t) / 4;
     static_assert(HalfDimensions % TileHeight == 0, "TileHeight must divide HalfDimensions");
@@ -194,34 +209,74 @@ namespace Stockfish::Eval::NNUE {
       return FeatureSet::HashValue ^ OutputDimensions;
     }
 
-    // Read network parameters
-    bool read_parameters(std::istream& stream) {
+    std::uint32_t net_id() const { return netId; }
+
+    // Tell the accumulator caches of the threads that the net has changed
+    void renew_net_id() { netId = new_net_id(); }
+
+    // Read network parameters, LEB128 encoded in compressed nets
+    bool read_parameters(std::istream& stream, bool compressed) {
+
+      renew_net_id();
 
-      read_little_endian<BiasType      >(stream, biases     , HalfDimensions                  );
-      read_little_endian<WeightType    >(stream, weights    , HalfDimensions * InputDimensions);
-      read_little_endian<PSQTWeightType>(stream, psqtWeights, PSQTBuckets    * InputDimensions);
+      if (compressed)
+      {
+        read_leb_128<BiasType      >(stream, biases     , HalfDimensions                  );
+        read_leb_128<WeightType    >(stream, weights    , HalfDimensions * InputDimensions);
+        read_leb_128<PSQTWeightType>(stream, psqtWeights, PSQTBuckets    * InputDimensions);
+      }
+      else
+      {
+        read_little_endian<BiasType      >(stream, biases     , HalfDimensions                  );
+        read_little_endian<WeightType    >(stream, weights    , HalfDimensions * InputDimensions);
+        read_little_endian<PSQTWeightType>(stream, psqtWeights, PSQTBuckets    * InputDimensions);
+      }
 
       return !stream.fail();
     }
 
     // Write network parameters
-    bool write_parameters(std::ostream& stream) const {
+    bool write_parameters(std::ostream& stream, bool compressed) const {
 
-      write_little_endian<BiasType      >(stream, biases     , HalfDimensions                  );
-      write_little_endian<WeightType    >(stream, weights    , HalfDimensions * InputDimensions);
-      write_little_endian<PSQTWeightType>(stream, psqtWeights, PSQTBuckets    * InputDimensions);
+      if (compressed)
+      {
+        write_leb_128<BiasType      >(stream, biases     , HalfDimensions                  );
+        write_leb_128<WeightType    >(stream, weights    , HalfDimensions * InputDimensions);
+        write_leb_128<PSQTWeightType>(stream, psqtWeights, PSQTBuckets    * InputDimensions);
+      }
+      else
+      {
+        write_little_endian<BiasType      >(stream, biases     , HalfDimensions                  );
+        write_little_endian<WeightType    >(stream, weights    , HalfDimensions * InputDimensions);
+        write_little_endian<PSQTWeightType>(stream, psqtWeights, PSQTBuckets    * InputDimensions);
+      }
 
       return !stream.fail();
     }
 
+    // PSQT part of the evaluation, which only needs the accumulators to be
+    // updated. They are then ready for a later transform() of the position.
+    std::int32_t psqt(const Position& pos, const AccumulatorStack& stack, AccumulatorCaches& cache, int bucket) const {
+
+      update_accumulators(pos, stack, cache);
+
+      const auto& psqtAccumulation = pos.state()->accumulator->psqtAccumulation;
+
+      return (  psqtAccumulation[ pos.side_to_move()][bucket]
+              - psqtAccumulation[~pos.side_to_move()][bucket]) / 2;
+    }
+
     // Convert input features
-    std::int32_t transform(const Position& pos, OutputType* output, int bucket) const {
-      update_accumulator(pos, WHITE);
-      update_accumulator(pos, BLACK);
+    std::int32_t transform(const Position& pos, const AccumulatorStack& stack, AccumulatorCaches& cache,
+                           OutputType* output, int bucket) const {
+
+      update_accumulators(pos, stack, cache);
+
+      NNUE_STAGE_TIMER(StageTransform, "Feature transformer");
 
       const Color perspectives[2] = {pos.side_to_move(), ~pos.side_to_move()};
-      const auto& accumulation = pos.state()->accumulator.accumulation;
-      const auto& psqtAccumulation = pos.state()->accumulator.psqtAccumulation;
+      const auto& accumulation = pos.state()->accumulator->accumulation;
+      const auto& psqtAccumulation = pos.state()->accumulator->psqtAccumulation;
 
       const auto psqt = (
             psqtAccumulation[perspectives[0]][bucket]
@@ -361,10 +416,52 @@ namespace Stockfish::Eval::NNUE {
 
    } // end of function transform()
 
+    // Prefetch the weight columns of the features changed by the last move,
+    // for both perspectives. Those of a perspective whose king moved are left
+    // out, as its accumulator is then refreshed from the accumulator cache.
+    void prefetch_weights(const Position& pos) const {
+
+      using IndexList = ValueList<IndexType, FeatureSet::MaxActiveDimensions>;
+
+      for (Color perspective : { WHITE, BLACK })
+      {
+        if (FeatureSet::requires_refresh(pos.state(), perspective))
+          continue;
+
+        IndexList removed, added;
+        FeatureSet::append_changed_indices(
+          pos.square<KING>(perspective), pos.state(), perspective, removed, added);
+
+        for (const auto index : removed)
+          prefetch_column(index);
+        for (const auto index : added)
+          prefetch_column(index);
+      }
+    }
+
 
 
    private:
-    void update_accumulator(const Position& pos, const Color perspective) const {
+    // Whether the accumulator of a state is computed for a perspective. It must
+    // be in the stack of the thread and still be claimed by the state.
+    static bool computed(const AccumulatorStack& stack, const StateInfo* st, Color perspective) {
+      return   stack.owns(st->accumulator)
+            && st->accumulator->state == st
+            && st->accumulator->computed[perspective];
+    }
+
+    void update_accumulators(const Position& pos, const AccumulatorStack& stack, AccumulatorCaches& cache) const {
+
+      NNUE_STAGE_TIMER(StageUpdate, "Accumulator updates");
+      assert(stack.owns(pos.state()->accumulator));
+      assert(stack.width() == HalfDimensions);
+      pos.state()->accumulator->claim(pos.state());
+      update_accumulator(pos, stack, cache, WHITE);
+      update_accumulator(pos, stack, cache, BLACK);
+    }
+
+    void update_accumulator(const Position& pos, const AccumulatorStack& stack,
+                            AccumulatorCaches& cache, const Color perspective) const {
 
       // The size must be enough to contain the largest possible update.
       // That might depend on the feature set and generally relies on the
@@ -383,7 +480,7 @@ namespace Stockfish::Eval::NNUE {
       // of the estimated gain in terms of features to be added/subtracted.
       StateInfo *st = pos.state(), *next = nullptr;
       int gain = FeatureSet::refresh_cost(pos);
-      while (st->previous && !st->accumulator.computed[perspective])
+      while (st->previous && !computed(stack, st, perspective))
       {
         // This governs when a full feature refresh is needed and how many
         // updates are better than just one full refresh.
@@ -394,7 +491,7 @@ namespace Stockfish::Eval::NNUE {
         st = st->previous;
       }
 
-      if (st->accumulator.computed[perspective])
+      if (computed(stack, st, perspective))
       {
         if (next == nullptr)
           return;
@@ -412,8 +509,10 @@ namespace Stockfish::Eval::NNUE {
             ksq, st2, perspective, removed[1], added[1]);
 
         // Mark the accumulators as computed.
-        next->accumulator.computed[perspective] = true;
-        pos.state()->accumulator.computed[perspective] = true;
+        assert(stack.owns(next->accumulator));
+        next->accumulator->claim(next);
+        next->accumulator->computed[perspective] = true;
+        pos.state()->accumulator->computed[perspective] = true;
 
         // Now update the accumulators listed in states_to_update[], where the last element is a sentinel.
         StateInfo *states_to_update[3] =
@@ -423,7 +522,7 @@ namespace Stockfish::Eval::NNUE {
         {
           // Load accumulator
           auto accTile = reinterpret_cast<vec_t*>(
-            &st->accumulator.accumulation[perspective][j * TileHeight]);
+            &st->accumulator->accumulation[perspective][j * TileHeight]);
           for (IndexType k = 0; k < NumRegs; ++k)
             acc[k] = vec_load(&accTile[k]);
 
@@ -449,7 +548,7 @@ namespace Stockfish::Eval::NNUE {
 
             // Store accumulator
             accTile = reinterpret_cast<vec_t*>(
-              &states_to_update[i]->accumulator.accumulation[perspective][j * TileHeight]);
+              &states_to_update[i]->accumulator->accumulation[perspective][j * TileHeight]);
             for (IndexType k = 0; k < NumRegs; ++k)
               vec_store(&accTile[k], acc[k]);
           }
@@ -459,7 +558,7 @@ namespace Stockfish::Eval::NNUE {
         {
           // Load accumulator
           auto accTilePsqt = reinterpret_cast<psqt_vec_t*>(
-            &st->accumulator.psqtAccumulation[perspective][j * PsqtTileHeight]);
+            &st->accumulator->psqtAccumulation[perspective][j * PsqtTileHeight]);
           for (std::size_t k = 0; k < NumPsqtRegs; ++k)
             psqt[k] = vec_load_psqt(&accTilePsqt[k]);
 
@@ -485,7 +584,7 @@ namespace Stockfish::Eval::NNUE {
 
             // Store accumulator
             accTilePsqt = reinterpret_cast<psqt_vec_t*>(
-              &states_to_update[i]->accumulator.psqtAccumulation[perspective][j * PsqtTileHeight]);
+              &states_to_update[i]->accumulator->psqtAccumulation[perspective][j * PsqtTileHeight]);
             for (std::size_t k = 0; k < NumPsqtRegs; ++k)
               vec_store_psqt(&accTilePsqt[k], psqt[k]);
           }
@@ -494,12 +593,12 @@ namespace Stockfish::Eval::NNUE {
   #else
         for (IndexType i = 0; states_to_update[i]; ++i)
         {
-          std::memcpy(states_to_update[i]->accumulator.accumulation[perspective],
-              st->accumulator.accumulation[perspective],
+          std::memcpy(states_to_update[i]->accumulator->accumulation[perspective],
+              st->accumulator->accumulation[perspective],
               HalfDimensions * sizeof(BiasType));
 
           for (std::size_t k = 0; k < PSQTBuckets; ++k)
-            states_to_update[i]->accumulator.psqtAccumulation[perspective][k] = st->accumulator.psqtAccumulation[perspective][k];
+            states_to_update[i]->accumulator->psqtAccumulation[perspective][k] = st->accumulator->psqtAccumulation[perspective][k];
 
           st = states_to_update[i];
 
@@ -509,10 +608,10 @@ namespace Stockfish::Eval::NNUE {
             const IndexType offset = HalfDimensions * index;
 
             for (IndexType j = 0; j < HalfDimensions; ++j)
-              st->accumulator.accumulation[perspective][j] -= weights[offset + j];
+              st->accumulator->accumulation[perspective][j] -= weights[offset + j];
 
             for (std::size_t k = 0; k < PSQTBuckets; ++k)
-              st->accumulator.psqtAccumulation[perspective][k] -= psqtWeights[index * PSQTBuckets + k];
+              st->accumulator->psqtAccumulation[perspective][k] -= psqtWeights[index * PSQTBuckets + k];
           }
 
           // Difference calculation for the activated features
@@ -521,51 +620,96 @@ namespace Stockfish::Eval::NNUE {
             const IndexType offset = HalfDimensions * index;
 
             for (IndexType j = 0; j < HalfDimensions; ++j)
-              st->accumulator.accumulation[perspective][j] += weights[offset + j];
+              st->accumulator->accumulation[perspective][j] += weights[offset + j];
 
             for (std::size_t k = 0; k < PSQTBuckets; ++k)
-              st->accumulator.psqtAccumulation[perspective][k] += psqtWeights[index * PSQTBuckets + k];
+              st->accumulator->psqtAccumulation[perspective][k] += psqtWeights[index * PSQTBuckets + k];
           }
         }
   #endif
       }
       else
       {
-        // Refresh the accumulator
-        auto& accumulator = pos.state()->accumulator;
-        accumulator.computed[perspective] = true;
-        IndexList active;
-        FeatureSet::append_active_indices(pos, perspective, active);
+        // Refresh the accumulator, starting from the cached one with the same
+        // king square and applying the difference between the two boards
+        auto accumulator = pos.state()->accumulator;
+        accumulator->computed[perspective] = true;
+
+        if (cache.reset(netId, HalfDimensions))
+          for (auto& entries : cache.entries)
+            for (auto& entry : entries)
+              reset_cache_entry(entry);
+
+        auto& entry = cache.entries[pos.square<KING>(perspective)][perspective];
+        IndexList removed, added;
+        FeatureSet::append_board_changes(pos, perspective, entry.byColorBB, entry.byTypeBB, removed, added);
+
+        // Start from scratch if this is cheaper
+        if (int(removed.size() + added.size()) > FeatureSet::refresh_cost(pos))
+        {
+          reset_cache_entry(entry);
+          removed.resize(0);
+          added.resize(0);
+          FeatureSet::append_board_changes(pos, perspective, entry.byColorBB, entry.byTypeBB, removed, added);
+        }
+
+        for (Color c : { WHITE, BLACK })
+          entry.byColorBB[c] = pos.pieces(c);
+        for (PieceType pt = PAWN; pt <= KING; ++pt)
+          entry.byTypeBB[pt] = pos.pieces(pt);
 
   #ifdef VECTOR
         for (IndexType j = 0; j < HalfDimensions / TileHeight; ++j)
         {
-          auto biasesTile = reinterpret_cast<const vec_t*>(
-              &biases[j * TileHeight]);
+          auto entryTile = reinterpret_cast<vec_t*>(
+              &entry.accumulation[j * TileHeight]);
           for (IndexType k = 0; k < NumRegs; ++k)
-            acc[k] = biasesTile[k];
+            acc[k] = vec_load(&entryTile[k]);
+
+          for (const auto index : removed)
+          {
+            const IndexType offset = HalfDimensions * index + j * TileHeight;
+            auto column = reinterpret_cast<const vec_t*>(&weights[offset]);
 
-          for (const auto index : active)
+            for (IndexType k = 0; k < NumRegs; ++k)
+              acc[k] = vec_sub_16(acc[k], column[k]);
+          }
+
+          for (const auto index : added)
           {
             const IndexType offset = HalfDimensions * index + j * TileHeight;
             auto column = reinterpret_cast<const vec_t*>(&weights[offset]);
 
-            for (unsigned k = 0; k < NumRegs; ++k)
+            for (IndexType k = 0; k < NumRegs; ++k)
               acc[k] = vec_add_16(acc[k], column[k]);
           }
 
           auto accTile = reinterpret_cast<vec_t*>(
-              &accumulator.accumulation[perspective][j * TileHeight]);
-          for (unsigned k = 0; k < NumRegs; k++)
+              &accumulator->accumulation[perspective][j * TileHeight]);
+          for (IndexType k = 0; k < NumRegs; ++k)
+          {
+            vec_store(&entryTile[k], acc[k]);
             vec_store(&accTile[k], acc[k]);
+          }
         }
 
         for (IndexType j = 0; j < PSQTBuckets / PsqtTileHeight; ++j)
         {
+          auto entryTilePsqt = reinterpret_cast<psqt_vec_t*>(
+              &entry.psqtAccumulation[j * PsqtTileHeight]);
           for (std::size_t k = 0; k < NumPsqtRegs; ++k)
-            psqt[k] = vec_zero_psqt();
+            psqt[k] = vec_load_psqt(&entryTilePsqt[k]);
+
+          for (const auto index : removed)
+          {
+            const IndexType offset = PSQTBuckets * index + j * PsqtTileHeight;
+            auto columnPsqt = reinterpret_cast<const psqt_vec_t*>(&psqtWeights[offset]);
+
+            for (std::size_t k = 0; k < NumPsqtRegs; ++k)
+              psqt[k] = vec_sub_psqt_32(psqt[k], columnPsqt[k]);
+          }
 
-          for (const auto index : active)
+          for (const auto index : added)
           {
             const IndexType offset = PSQTBuckets * index + j * PsqtTileHeight;
             auto columnPsqt = reinterpret_cast<const psqt_vec_t*>(&psqtWeights[offset]);
@@ -575,28 +719,41 @@ namespace Stockfish::Eval::NNUE {
           }
 
           auto accTilePsqt = reinterpret_cast<psqt_vec_t*>(
-            &accumulator.psqtAccumulation[perspective][j * PsqtTileHeight]);
+            &accumulator->psqtAccumulation[perspective][j * PsqtTileHeight]);
           for (std::size_t k = 0; k < NumPsqtRegs; ++k)
+          {
+            vec_store_psqt(&entryTilePsqt[k], psqt[k]);
             vec_store_psqt(&accTilePsqt[k], psqt[k]);
+          }
         }
 
   #else
-        std::memcpy(accumulator.accumulation[perspective], biases,
-            HalfDimensions * sizeof(BiasType));
+        for (const auto index : removed)
+        {
+          const IndexType offset = HalfDimensions * index;
+
+          for (IndexType j = 0; j < HalfDimensions; ++j)
+            entry.accumulation[j] -= weights[offset + j];
 
-        for (std::size_t k = 0; k < PSQTBuckets; ++k)
-          accumulator.psqtAccumulation[perspective][k] = 0;
+          for (std::size_t k = 0; k < PSQTBuckets; ++k)
+            entry.psqtAccumulation[k] -= psqtWeights[index * PSQTBuckets + k];
+        }
 
-        for (const auto index : active)
+        for (const auto index : added)
         {
           const IndexType offset = HalfDimensions * index;
 
           for (IndexType j = 0; j < HalfDimensions; ++j)
-            accumulator.accumulation[perspective][j] += weights[offset + j];
+            entry.accumulation[j] += weights[offset + j];
 
           for (std::size_t k = 0; k < PSQTBuckets; ++k)
-            accumulator.psqtAccumulation[perspective][k] += psqtWeights[index * PSQTBuckets + k];
+            entry.psqtAccumulation[k] += psqtWeights[index * PSQTBuckets + k];
         }
+
+        std::memcpy(accumulator->accumulation[perspective], entry.accumulation,
+            HalfDimensions * sizeof(BiasType));
+        std::memcpy(accumulator->psqtAccumulation[perspective], entry.psqtAccumulation,
+            PSQTBuckets * sizeof(PSQTWeightType));
   #endif
       }
 
@@ -605,11 +762,32 @@ namespace Stockfish::Eval::NNUE {
   #endif
     }
 
+    // Prefetch all the cache lines of the weights of a feature
+    void prefetch_column(IndexType index) const {
+
+      const char* column = reinterpret_cast<const char*>(&weights[HalfDimensions * index]);
+      for (std::size_t i = 0; i < HalfDimensions * sizeof(WeightType); i += CacheLineSize)
+        prefetch(const_cast<char*>(column + i));
+
+      prefetch(const_cast<PSQTWeightType*>(&psqtWeights[PSQTBuckets * index]));
+    }
+
+    // Set a cache entry to the accumulator of an empty board
+    void reset_cache_entry(AccumulatorCaches::Entry& entry) const {
+
+      std::memcpy(entry.accumulation, biases, HalfDimensions * sizeof(BiasType));
+      std::memset(entry.psqtAccumulation, 0, sizeof(entry.psqtAccumulation));
+      std::memset(entry.byColorBB, 0, sizeof(entry.byColorBB));
+      std::memset(entry.byTypeBB, 0, sizeof(entry.byTypeBB));
+    }
+
+    std::uint32_t netId;
     alignas(CacheLineSize) BiasType biases[HalfDimensions];
     alignas(CacheLineSize) WeightType weights[HalfDimensions * InputDimensions];
     alignas(CacheLineSize) PSQTWeightType psqtWeights[InputDimensions * PSQTBuckets];
   };
 
+NNUE_VARIANT_END
 }  // namespace Stockfish::Eval::NNUE
 
 #endif // #ifndef NNUE_FEATURE_TRANSFORMER_H_INCLUDED
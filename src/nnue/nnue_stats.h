@@ -0,0 +1,99 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2021 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Cycle counts of the parts of the NNUE evaluation function
+
+#ifndef NNUE_STATS_H_INCLUDED
+#define NNUE_STATS_H_INCLUDED
+
+#if defined(NNUE_STATS)
+
+#include <cstdint>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#  if defined(_MSC_VER)
+#    include <intrin.h>
+#  else
+#    include <x86intrin.h>
+#  endif
+#  define NNUE_STATS_RDTSC
+#  define NNUE_STATS_UNIT "Cycles"
+#else
+#  include <chrono>
+#  define NNUE_STATS_UNIT "Nanoseconds"
+#endif
+
+namespace Stockfish::Eval::NNUE {
+
+  // Parts of the evaluation the time is accounted to: the updates of the
+  // accumulators, the rest of the feature transformer, then each layer of the
+  // network from the input, by their LayerIndex.
+  enum Stage { StageUpdate, StageTransform, StageLayers, StageNb = StageLayers + 8 };
+
+  // NnueStats holds the time spent by a search thread in each stage, in cycles
+  // of the time stamp counter (in nanoseconds where it is not available), and
+  // the number of times it was run. They are only collected when compiling with
+  // nnuestats=yes, so that the hot path is unchanged otherwise. NnueStats::local
+  // points to the counters of the calling thread, or is null for threads outside
+  // of the pool.
+  struct NnueStats {
+    std::uint64_t cycles[StageNb], calls[StageNb];
+
+    std::string report() const;
+
+    static std::uint64_t now() {
+#if defined(NNUE_STATS_RDTSC)
+      return __rdtsc();
+#else
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    static thread_local NnueStats* local;
+    static const char* names[StageNb];
+  };
+
+  // StageTimer adds the time from its construction to its destruction to a stage
+  class StageTimer {
+    int stage;
+    std::uint64_t start;
+
+  public:
+    StageTimer(int s, const char* name) : stage(s), start(NnueStats::now()) {
+      NnueStats::names[s] = name;
+    }
+
+    ~StageTimer() {
+      if (NnueStats::local)
+      {
+          NnueStats::local->cycles[stage] += NnueStats::now() - start;
+          NnueStats::local->calls[stage]++;
+      }
+    }
+  };
+
+}  // namespace Stockfish::Eval::NNUE
+
+#  define NNUE_STAGE_TIMER(stage, name) StageTimer stageTimer(stage, name)
+#else
+#  define NNUE_STAGE_TIMER(stage, name)
+#endif
+
+#endif // NNUE_STATS_H_INCLUDED
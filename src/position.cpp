@@ -24,6 +24,8 @@
 #include <sstream>
 
 #include "bitboard.h"
+#include "engine.h"
+#include "evaluate.h"
 #include "misc.h"
 #include "movegen.h"
 #include "position.h"
@@ -78,11 +80,13 @@ std::ostream& operator<<(std::ostream& os, const Position& pos) {
   if (    int(Tablebases::MaxCardinality) >= popcount(pos.pieces())
       && !pos.can_castle(ANY_CASTLING))
   {
+      // The probes make moves. Their accumulators are not the ones of the
+      // thread, which may be searching while the position is displayed.
       StateInfo st;
-      ASSERT_ALIGNED(&st, Eval::NNUE::CacheLineSize);
+      Eval::NNUE::AccumulatorStack stack;
 
       Position p;
-      p.set(pos.fen(), pos.is_chess960(), &st, pos.this_thread());
+      p.set(pos.fen(), pos.is_chess960(), &st, pos.this_thread(), &stack);
       Tablebases::ProbeState s1, s2;
       Tablebases::WDLScore wdl = Tablebases::probe_wdl(p, &s1);
       int dtz = Tablebases::probe_dtz(p, &s2);
@@ -154,9 +158,12 @@ void Position::init() {
 
 /// Position::set() initializes the position object with the given FEN string.
 /// This function is not very robust - make sure that input FENs are correct,
-/// this is assumed to be the responsibility of the GUI.
+/// this is assumed to be the responsibility of the GUI. The accumulators of the
+/// states are taken from the stack of the thread, or from the given stack for a
+/// position that must not use the slots of a thread that may be searching.
 
-Position& Position::set(const string& fenStr, bool isChess960, StateInfo* si, Thread* th) {
+Position& Position::set(const string& fenStr, bool isChess960, StateInfo* si, Thread* th,
+                        Eval::NNUE::AccumulatorStack* stack) {
 /*
    A FEN string defines a particular position using only the ASCII character set.
 
@@ -281,6 +288,8 @@ Position& Position::set(const string& fenStr, bool isChess960, StateInfo* si, Th
 
   chess960 = isChess960;
   thisThread = th;
+  accumulators = stack ? stack : th ? &th->accumulatorStack : nullptr;
+  st->accumulator = accumulators ? accumulators->root(st, Eval::NNUE::transformed_width()) : nullptr;
   set_state(st);
 
   assert(pos_is_ok());
@@ -702,8 +711,7 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
   ++st->pliesFromNull;
 
   // Used by NNUE
-  st->accumulator.computed[WHITE] = false;
-  st->accumulator.computed[BLACK] = false;
+  st->accumulator = accumulators->next(st->previous->accumulator, st);
   auto& dp = st->dirtyPiece;
   dp.dirty_num = 1;
 
@@ -862,6 +870,10 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
   // Update the key with the final value
   st->key = k;
 
+  // Prefetch the NNUE weights the next evaluation will need
+  if (Eval::useNNUE && thisThread->prefetchWeights)
+      Eval::NNUE::prefetch_weights(*this);
+
   // Calculate checkers bitboard (if move gives check)
   st->checkersBB = givesCheck ? attackers_to(square<KING>(them)) & pieces(us) : 0;
 
@@ -1003,8 +1015,7 @@ void Position::do_null_move(StateInfo& newSt) {
 
   st->dirtyPiece.dirty_num = 0;
   st->dirtyPiece.piece[0] = NO_PIECE; // Avoid checks in UpdateAccumulator()
-  st->accumulator.computed[WHITE] = false;
-  st->accumulator.computed[BLACK] = false;
+  st->accumulator = accumulators->next(st->previous->accumulator, st);
 
   if (st->epSquare != SQ_NONE)
   {
@@ -1013,7 +1024,7 @@ void Position::do_null_move(StateInfo& newSt) {
   }
 
   st->key ^= Zobrist::side;
-  prefetch(TT.first_entry(key()));
+  prefetch(thisThread->engine.tt.first_entry(key()));
 
   ++st->rule50;
   st->pliesFromNull = 0;
@@ -1272,7 +1283,7 @@ void Position::flip() {
   std::getline(ss, token); // Half and full moves
   f += token;
 
-  set(f, is_chess960(), st, this_thread());
+  set(f, is_chess960(), st, this_thread(), accumulators);
 
   assert(pos_is_ok());
 }
@@ -1318,7 +1329,6 @@ bool Position::pos_is_ok() const {
               assert(0 && "pos_is_ok: Bitboards");
 
   StateInfo si = *st;
-  ASSERT_ALIGNED(&si, Eval::NNUE::CacheLineSize);
 
   set_state(&si);
   if (std::memcmp(&si, st, sizeof(StateInfo)))
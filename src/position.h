@@ -58,8 +58,8 @@ struct StateInfo {
   Piece      capturedPiece;
   int        repetition;
 
-  // Used by NNUE
-  Eval::NNUE::Accumulator accumulator;
+  // Used by NNUE, the accumulator is in the stack of the thread
+  Eval::NNUE::Accumulator* accumulator;
   DirtyPiece dirtyPiece;
 };
 
@@ -86,7 +86,8 @@ public:
   Position& operator=(const Position&) = delete;
 
   // FEN string input/output
-  Position& set(const std::string& fenStr, bool isChess960, StateInfo* si, Thread* th);
+  Position& set(const std::string& fenStr, bool isChess960, StateInfo* si, Thread* th,
+                Eval::NNUE::AccumulatorStack* stack = nullptr);
   Position& set(const std::string& code, Color c, StateInfo* si);
   std::string fen() const;
 
@@ -194,6 +195,7 @@ private:
   Square castlingRookSquare[CASTLING_RIGHT_NB];
   Bitboard castlingPath[CASTLING_RIGHT_NB];
   Thread* thisThread;
+  Eval::NNUE::AccumulatorStack* accumulators; // Slots of the states, see set()
   StateInfo* st;
   int gamePly;
   Color sideToMove;
@@ -23,6 +23,7 @@
 #include <iostream>
 #include <sstream>
 
+#include "engine.h"
 #include "evaluate.h"
 #include "misc.h"
 #include "movegen.h"
@@ -37,21 +38,10 @@
 
 namespace Stockfish {
 
-namespace Search {
-
-  LimitsType Limits;
-}
-
-namespace Tablebases {
-
-  int Cardinality;
-  bool RootInTB;
-  bool UseRule50;
-  Depth ProbeDepth;
-}
-
 namespace TB = Tablebases;
 
+extern std::string epd_id(const std::string&);
+
 using std::string;
 using Eval::evaluate;
 using namespace Search;
@@ -69,6 +59,10 @@ namespace {
     return Value(214 * (d - improving));
   }
 
+  // Margin of the PSQT estimate of the NNUE over the full evaluation, for the
+  // pruning decisions taken before the full evaluation with "NNUE PSQT Prescreen"
+  constexpr Value PsqtPrescreenMargin = Value(250);
+
   // Reductions lookup table, initialized at startup
   int Reductions[MAX_MOVES]; // [depth or moveNumber]
 
@@ -91,12 +85,18 @@ namespace {
     return VALUE_DRAW + Value(2 * (thisThread->nodes & 1) - 1);
   }
 
+  // Search of the thread has to stop, either for all threads or, in batch mode,
+  // only for the position the thread is searching.
+  bool stopped(const Thread* thisThread) {
+    return thisThread->engine.threads.stop.load(std::memory_order_relaxed) || thisThread->batchStop;
+  }
+
   // Skill structure is used to implement strength limit
   struct Skill {
     explicit Skill(int l) : level(l) {}
     bool enabled() const { return level < 20; }
     bool time_to_pick(Depth depth) const { return depth == 1 + level; }
-    Move pick_best(size_t multiPV);
+    Move pick_best(const RootMoves& rootMoves, size_t multiPV);
 
     int level;
     Move best = MOVE_NONE;
@@ -116,32 +116,268 @@ namespace {
   void update_all_stats(const Position& pos, Stack* ss, Move bestMove, Value bestValue, Value beta, Square prevSq,
                         Move* quietsSearched, int quietCount, Move* capturesSearched, int captureCount, Depth depth);
 
+  // PerftTable is the optional hash table of perft(), shared by the threads
+  // and sized by the "Perft Hash" option. An entry holds the count of the
+  // nodes of a position at a depth, together with the position key xored with
+  // the data, so that an entry torn by concurrent writes does not match.
+  class PerftTable {
+
+    struct Entry {
+      uint64_t check, data; // data = nodes << 8 | depth
+    };
+
+  public:
+    explicit PerftTable(size_t mbSize) : count(mbSize * 1024 * 1024 / sizeof(Entry)) {
+
+      table = count ? static_cast<Entry*>(aligned_large_pages_alloc(count * sizeof(Entry))) : nullptr;
+
+      if (count && !table)
+      {
+          std::cerr << "Failed to allocate " << mbSize << "MB for the perft hash." << std::endl;
+          exit(EXIT_FAILURE);
+      }
+
+      if (table)
+          std::memset(static_cast<void*>(table), 0, count * sizeof(Entry));
+    }
+
+   ~PerftTable() { aligned_large_pages_free(table); }
+
+    PerftTable(const PerftTable&) = delete;
+    PerftTable& operator=(const PerftTable&) = delete;
+
+    bool enabled() const { return table; }
+
+    bool probe(Key key, Depth depth, uint64_t& nodes) const {
+
+      const Entry& e = entry(key);
+      const uint64_t data = e.data;
+
+      if ((e.check ^ data) != key || Depth(data & 0xFF) != depth)
+          return false;
+
+      nodes = data >> 8;
+      return true;
+    }
+
+    void store(Key key, Depth depth, uint64_t nodes) {
+
+      Entry& e = entry(key);
+      e.data = nodes << 8 | uint64_t(depth);
+      e.check = key ^ e.data;
+    }
+
+  private:
+    Entry& entry(Key key) const { return table[mul_hi64(key, count)]; }
+
+    size_t count;
+    Entry* table;
+  };
+
   // perft() is our utility to verify move generation. All the leaf nodes up
   // to the given depth are generated and counted, and the sum is returned.
-  template<bool Root>
-  uint64_t perft(Position& pos, Depth depth) {
+  // The last ply is counted in bulk, from the size of the move lists.
+  uint64_t perft(Position& pos, Depth depth, PerftTable& table) {
+
+    assert(depth >= 2);
 
     StateInfo st;
-    ASSERT_ALIGNED(&st, Eval::NNUE::CacheLineSize);
 
-    uint64_t cnt, nodes = 0;
+    uint64_t nodes = 0;
     const bool leaf = (depth == 2);
 
+    // Positions at depth 2 are cheaper to count than to look up
+    if (!leaf && table.enabled() && table.probe(pos.key(), depth, nodes))
+        return nodes;
+
     for (const auto& m : MoveList<LEGAL>(pos))
     {
-        if (Root && depth <= 1)
-            cnt = 1, nodes++;
+        pos.do_move(m, st);
+        nodes += leaf ? MoveList<LEGAL>(pos).size() : perft(pos, depth - 1, table);
+        pos.undo_move(m);
+    }
+
+    if (!leaf && table.enabled())
+        table.store(pos.key(), depth, nodes);
+
+    return nodes;
+  }
+
+  // Perft holds the root moves of a 'go perft', which are handed out one at a
+  // time to the threads of the pool, so that a thread done with a small
+  // subtree takes the next move. See perft_root().
+  struct Perft {
+    std::vector<Move> moves;
+    std::vector<uint64_t> counts;
+    std::atomic<size_t> next;
+    Depth depth;
+    PerftTable* table;
+  };
+
+  // perft_root() is run by each thread of the pool for 'go perft', on the root
+  // position of the thread.
+  void perft_root(Thread* th, Perft& job) {
+
+    Position& pos = th->rootPos;
+    StateInfo st;
+
+    for (size_t i = job.next++; i < job.moves.size(); i = job.next++)
+    {
+        const Move m = job.moves[i];
+
+        if (job.depth <= 1)
+            job.counts[i] = 1;
         else
         {
             pos.do_move(m, st);
-            cnt = leaf ? MoveList<LEGAL>(pos).size() : perft<false>(pos, depth - 1);
-            nodes += cnt;
+            job.counts[i] = job.depth == 2 ? MoveList<LEGAL>(pos).size()
+                                           : perft(pos, job.depth - 1, *job.table);
             pos.undo_move(m);
         }
-        if (Root)
-            sync_cout << UCI::move(m, pos.is_chess960()) << ": " << cnt << sync_endl;
     }
-    return nodes;
+  }
+
+  // perft_divide() runs 'go perft' on all the threads of the pool, then prints
+  // the count of each root move, in move generation order, and the total with
+  // the speed. The nodes of the search are set to the total, for 'bench'.
+  void perft_divide(Engine& engine) {
+
+    Thread* main = engine.threads.main();
+    PerftTable table(size_t(engine.options["Perft Hash"]));
+    Perft job;
+
+    for (const auto& m : MoveList<LEGAL>(main->rootPos))
+        job.moves.push_back(m);
+
+    job.counts.resize(job.moves.size());
+    job.next = 0;
+    job.depth = engine.limits.perft;
+    job.table = &table;
+
+    for (Thread* th : engine.threads)
+        if (th != main)
+            th->start_custom_job([th, &job]() { perft_root(th, job); });
+
+    perft_root(main, job);
+    engine.threads.wait_for_search_finished();
+
+    uint64_t nodes = 0;
+    std::stringstream ss;
+
+    for (size_t i = 0; i < job.moves.size(); ++i)
+    {
+        ss << UCI::move(job.moves[i], main->rootPos.is_chess960()) << ": " << job.counts[i] << "\n";
+        nodes += job.counts[i];
+    }
+
+    TimePoint elapsed = now() - engine.limits.startTime + 1;
+
+    ss << "\nNodes searched: " << nodes
+       << "\nNodes/second: "   << nodes * 1000 / elapsed << "\n";
+
+    // The threads have counted their calls to do_move() as nodes
+    for (Thread* th : engine.threads)
+        th->nodes = 0;
+
+    main->nodes = nodes;
+
+    engine.out << IO_LOCK << ss.str() << sync_endl;
+  }
+
+  // Batch holds the positions of a 'go batch' command. They are handed out one
+  // at a time to the threads of the pool, see search_batch().
+  struct Batch {
+    std::vector<string> positions;
+    bool chess960;
+    std::atomic<size_t> next, searched, workers;
+    std::atomic<uint64_t> nodes;
+  };
+
+  // search_batch() is run by each thread of the pool for 'go batch'. The thread
+  // takes the next position of the batch and searches it alone, with its own
+  // root position and histories, until the depth or nodes limit is reached,
+  // then prints the result as a single line. The last thread to finish prints
+  // a summary of the batch.
+  void search_batch(Thread* th, Batch& batch) {
+
+    Engine& engine = th->engine;
+    th->batch = true;
+
+    for (size_t i = batch.next++; i < batch.positions.size() && !engine.threads.stop; i = batch.next++)
+    {
+        TimePoint start = now();
+
+        th->rootPos.set(batch.positions[i], batch.chess960, &th->rootState, th);
+        th->rootMoves.clear();
+        for (const auto& m : MoveList<LEGAL>(th->rootPos))
+            th->rootMoves.emplace_back(m);
+
+        th->nodes = th->tbHits = th->nmpMinPly = th->bestMoveChanges = 0;
+        th->rootDepth = th->completedDepth = 0;
+        th->batchStop = false;
+
+        if (th->rootMoves.empty())
+        {
+            th->rootMoves.emplace_back(MOVE_NONE);
+            th->rootMoves[0].score = th->rootPos.checkers() ? -VALUE_MATE : VALUE_DRAW;
+        }
+        else
+        {
+            th->Thread::search(); // Not MainThread::search() for the main thread
+
+            // A position interrupted by 'stop' before completing depth 1 has
+            // no result to report.
+            if (!th->completedDepth)
+                break;
+        }
+
+        const RootMove& rm = th->rootMoves[0];
+        Value v = rm.score != -VALUE_INFINITE ? rm.score : rm.previousScore;
+        uint64_t nodes = th->nodes;
+        TimePoint elapsed = now() - start + 1;
+        string id = epd_id(batch.positions[i]);
+
+        std::stringstream ss;
+
+        ss << "batch " << i + 1;
+
+        if (!id.empty())
+            ss << " id " << id;
+
+        ss << " depth "    << th->completedDepth
+           << " seldepth " << rm.selDepth
+           << " score "    << UCI::value(v)
+           << " nodes "    << nodes
+           << " nps "      << nodes * 1000 / elapsed
+           << " time "     << elapsed
+           << " bestmove " << UCI::move(rm.pv[0], batch.chess960);
+
+        if (rm.pv[0] != MOVE_NONE)
+        {
+            ss << " pv";
+            for (Move m : rm.pv)
+                ss << " " << UCI::move(m, batch.chess960);
+        }
+
+        engine.out << IO_LOCK << ss.str() << sync_endl;
+
+        batch.nodes += nodes;
+        batch.searched++;
+    }
+
+    th->batch = th->batchStop = false;
+
+    if (--batch.workers == 0)
+    {
+        TimePoint elapsed = now() - engine.limits.startTime + 1;
+
+        engine.out << IO_LOCK << "batch done positions " << batch.searched
+                   << " nodes " << batch.nodes
+                   << " nps "   << batch.nodes * 1000 / elapsed
+                   << " time "  << elapsed << sync_endl;
+
+        engine.threads.batching = false;
+    }
   }
 
 } // namespace
@@ -156,16 +392,55 @@ void Search::init() {
 }
 
 
-/// Search::clear() resets search state to its initial value
+/// Search::clear() resets search state of the engine to its initial value
+
+void Search::clear(Engine& engine) {
+
+  engine.threads.main()->wait_for_search_finished();
+
+  engine.time.availableNodes = 0;
+  engine.threads.clear(true);
+
+  // Free mapped files, unless other engines may be probing them
+  if (Engine::count() == 1)
+      Tablebases::init(engine.options["SyzygyPath"], engine.out);
+}
+
+
+/// Search::start_batch() is called by 'go batch'. The positions are searched
+/// concurrently, each one by a single thread of the pool, with the depth and
+/// nodes limits applying to every position. Results are printed as soon as a
+/// position is done, in completion order. The function returns immediately,
+/// and 'stop' aborts the positions not searched yet. Until the batch is done,
+/// the commands that would wait for it are refused, see UCI::execute().
 
-void Search::clear() {
+void Search::start_batch(Engine& engine, const std::vector<string>& positions, const LimitsType& limits) {
 
-  Threads.main()->wait_for_search_finished();
+  engine.tt.stop_clear();
+  engine.threads.wait_for_jobs_finished();
 
-  Time.availableNodes = 0;
-  TT.clear();
-  Threads.clear();
-  Tablebases::init(Options["SyzygyPath"]); // Free mapped files
+  // Time, mate and pondering make no sense for a batch
+  LimitsType batchLimits;
+  batchLimits.startTime = limits.startTime;
+  batchLimits.nodes = limits.nodes;
+  batchLimits.depth = limits.depth || limits.nodes ? limits.depth : 13;
+  engine.limits = batchLimits;
+
+  engine.threads.stop = false;
+  engine.threads.increaseDepth = true;
+  engine.tt.new_search();
+  engine.tbConfig = TB::probe_config(engine.options); // Root positions are not ranked
+
+  Eval::NNUE::verify(engine);
+
+  auto batch = std::make_shared<Batch>();
+  batch->positions = positions;
+  batch->chess960 = bool(engine.options["UCI_Chess960"]);
+  batch->next = batch->searched = batch->nodes = 0;
+  batch->workers = engine.threads.size();
+
+  engine.threads.batching = true;
+  engine.threads.start_job([&engine, batch](size_t idx) { search_batch(engine.threads[idx], *batch); });
 }
 
 
@@ -174,73 +449,82 @@ void Search::clear() {
 
 void MainThread::search() {
 
-  if (Limits.perft)
+  if (engine.limits.perft)
   {
-      nodes = perft<true>(rootPos, Limits.perft);
-      sync_cout << "\nNodes searched: " << nodes << "\n" << sync_endl;
+      perft_divide(engine);
       return;
   }
 
   Color us = rootPos.side_to_move();
-  Time.init(Limits, us, rootPos.game_ply());
-  TT.new_search();
+  engine.time.init(engine.limits, us, rootPos.game_ply());
+  engine.tt.new_search();
 
-  Eval::NNUE::verify();
+  Eval::NNUE::verify(engine);
 
   if (rootMoves.empty())
   {
       rootMoves.emplace_back(MOVE_NONE);
-      sync_cout << "info depth 0 score "
+      engine.out << IO_LOCK << "info depth 0 score "
                 << UCI::value(rootPos.checkers() ? -VALUE_MATE : VALUE_DRAW)
                 << sync_endl;
   }
   else
   {
-      Threads.start_searching(); // start non-main threads
+      engine.threads.start_searching(); // start non-main threads
       Thread::search();          // main thread start searching
   }
 
   // When we reach the maximum depth, we can arrive here without a raise of
-  // Threads.stop. However, if we are pondering or in an infinite search,
+  // engine.threads.stop. However, if we are pondering or in an infinite search,
   // the UCI protocol states that we shouldn't print the best move before the
   // GUI sends a "stop" or "ponderhit" command. We therefore simply wait here
   // until the GUI sends one of those commands.
 
-  while (!Threads.stop && (ponder || Limits.infinite))
+  while (!engine.threads.stop && (ponder || engine.limits.infinite))
   {} // Busy wait for a stop or a ponder reset
 
   // Stop the threads if not already stopped (also raise the stop if
-  // "ponderhit" just reset Threads.ponder).
-  Threads.stop = true;
+  // "ponderhit" just reset engine.threads.ponder).
+  engine.threads.stop = true;
 
   // Wait until all threads have finished
-  Threads.wait_for_search_finished();
+  engine.threads.wait_for_search_finished();
+
+  // Report the hit rate of the evaluation caches, to help sizing them
+  uint64_t evalProbes = 0, evalHits = 0;
+
+  for (Thread* th : engine.threads)
+      evalProbes += th->evalCache.probes, evalHits += th->evalCache.hits;
+
+  if (evalProbes)
+      engine.out << IO_LOCK << "info string Eval Cache hits " << evalHits * 100 / evalProbes
+                 << "% of " << evalProbes << " probes" << sync_endl;
 
   // When playing in 'nodes as time' mode, subtract the searched nodes from
   // the available ones before exiting.
-  if (Limits.npmsec)
-      Time.availableNodes += Limits.inc[us] - Threads.nodes_searched();
+  if (engine.limits.npmsec)
+      engine.time.availableNodes += engine.limits.inc[us] - engine.threads.nodes_searched();
 
   Thread* bestThread = this;
 
-  if (   int(Options["MultiPV"]) == 1
-      && !Limits.depth
-      && !(Skill(Options["Skill Level"]).enabled() || int(Options["UCI_LimitStrength"]))
+  if (   int(engine.options["MultiPV"]) == 1
+      && !engine.limits.depth
+      && !(Skill(engine.options["Skill Level"]).enabled() || int(engine.options["UCI_LimitStrength"]))
       && rootMoves[0].pv[0] != MOVE_NONE)
-      bestThread = Threads.get_best_thread();
+      bestThread = engine.threads.get_best_thread();
 
   bestPreviousScore = bestThread->rootMoves[0].score;
 
   // Send again PV info if we have a new best thread
   if (bestThread != this)
-      sync_cout << UCI::pv(bestThread->rootPos, bestThread->completedDepth, -VALUE_INFINITE, VALUE_INFINITE) << sync_endl;
+      engine.out << IO_LOCK << UCI::pv(bestThread->rootPos, bestThread->completedDepth, -VALUE_INFINITE, VALUE_INFINITE) << sync_endl;
 
-  sync_cout << "bestmove " << UCI::move(bestThread->rootMoves[0].pv[0], rootPos.is_chess960());
+  engine.out << IO_LOCK << "bestmove " << UCI::move(bestThread->rootMoves[0].pv[0], rootPos.is_chess960());
 
   if (bestThread->rootMoves[0].pv.size() > 1 || bestThread->rootMoves[0].extract_ponder_from_tt(rootPos))
-      std::cout << " ponder " << UCI::move(bestThread->rootMoves[0].pv[1], rootPos.is_chess960());
+      engine.out << " ponder " << UCI::move(bestThread->rootMoves[0].pv[1], rootPos.is_chess960());
 
-  std::cout << sync_endl;
+  engine.out << sync_endl;
 }
 
 
@@ -259,7 +543,7 @@ void Thread::search() {
   Value bestValue, alpha, beta, delta;
   Move  lastBestMove = MOVE_NONE;
   Depth lastBestMoveDepth = 0;
-  MainThread* mainThread = (this == Threads.main() ? Threads.main() : nullptr);
+  MainThread* mainThread = (this == engine.threads.main() && !batch ? engine.threads.main() : nullptr);
   double timeReduction = 1, totBestMoveChanges = 0;
   Color us = rootPos.side_to_move();
   int iterIdx = 0;
@@ -289,7 +573,9 @@ void Thread::search() {
   std::copy(&lowPlyHistory[2][0], &lowPlyHistory.back().back() + 1, &lowPlyHistory[0][0]);
   std::fill(&lowPlyHistory[MAX_LPH - 2][0], &lowPlyHistory.back().back() + 1, 0);
 
-  size_t multiPV = size_t(Options["MultiPV"]);
+  size_t multiPV = size_t(engine.options["MultiPV"]);
+  psqtPrescreen = Eval::useNNUE && bool(engine.options["NNUE PSQT Prescreen"]);
+  prefetchWeights = bool(engine.options["NNUE Prefetch"]);
 
   // Pick integer skill levels, but non-deterministically round up or down
   // such that the average integer skill corresponds to the input floating point one.
@@ -297,9 +583,9 @@ void Thread::search() {
   // to CCRL Elo (goldfish 1.13 = 2000) and a fit through Ordo derived Elo
   // for match (TC 60+0.6) results spanning a wide range of k values.
   PRNG rng(now());
-  double floatLevel = Options["UCI_LimitStrength"] ?
-                      std::clamp(std::pow((Options["UCI_Elo"] - 1346.6) / 143.4, 1 / 0.806), 0.0, 20.0) :
-                        double(Options["Skill Level"]);
+  double floatLevel = engine.options["UCI_LimitStrength"] ?
+                      std::clamp(std::pow((engine.options["UCI_Elo"] - 1346.6) / 143.4, 1 / 0.806), 0.0, 20.0) :
+                        double(engine.options["Skill Level"]);
   int intLevel = int(floatLevel) +
                  ((floatLevel - int(floatLevel)) * 1024 > rng.rand<unsigned>() % 1024  ? 1 : 0);
   Skill skill(intLevel);
@@ -318,8 +604,8 @@ void Thread::search() {
 
   // Iterative deepening loop until requested to stop or the target depth is reached
   while (   ++rootDepth < MAX_PLY
-         && !Threads.stop
-         && !(Limits.depth && mainThread && rootDepth > Limits.depth))
+         && !stopped(this)
+         && !(engine.limits.depth && (mainThread || batch) && rootDepth > engine.limits.depth))
   {
       // Age out PV variability metric
       if (mainThread)
@@ -333,11 +619,11 @@ void Thread::search() {
       size_t pvFirst = 0;
       pvLast = 0;
 
-      if (!Threads.increaseDepth)
+      if (!engine.threads.increaseDepth)
          searchAgainCounter++;
 
       // MultiPV loop. We perform a full root search for each PV line
-      for (pvIdx = 0; pvIdx < multiPV && !Threads.stop; ++pvIdx)
+      for (pvIdx = 0; pvIdx < multiPV && !stopped(this); ++pvIdx)
       {
           if (pvIdx == pvLast)
           {
@@ -385,7 +671,7 @@ void Thread::search() {
               // If search has been stopped, we break immediately. Sorting is
               // safe because RootMoves is still valid, although it refers to
               // the previous iteration.
-              if (Threads.stop)
+              if (stopped(this))
                   break;
 
               // When failing high/low give some update (without cluttering
@@ -393,8 +679,8 @@ void Thread::search() {
               if (   mainThread
                   && multiPV == 1
                   && (bestValue <= alpha || bestValue >= beta)
-                  && Time.elapsed() > 3000)
-                  sync_cout << UCI::pv(rootPos, rootDepth, alpha, beta) << sync_endl;
+                  && engine.time.elapsed() > 3000)
+                  engine.out << IO_LOCK << UCI::pv(rootPos, rootDepth, alpha, beta) << sync_endl;
 
               // In case of failing low/high increase aspiration window and
               // re-search, otherwise exit the loop.
@@ -424,11 +710,11 @@ void Thread::search() {
           std::stable_sort(rootMoves.begin() + pvFirst, rootMoves.begin() + pvIdx + 1);
 
           if (    mainThread
-              && (Threads.stop || pvIdx + 1 == multiPV || Time.elapsed() > 3000))
-              sync_cout << UCI::pv(rootPos, rootDepth, alpha, beta) << sync_endl;
+              && (engine.threads.stop || pvIdx + 1 == multiPV || engine.time.elapsed() > 3000))
+              engine.out << IO_LOCK << UCI::pv(rootPos, rootDepth, alpha, beta) << sync_endl;
       }
 
-      if (!Threads.stop)
+      if (!stopped(this))
           completedDepth = rootDepth;
 
       if (rootMoves[0].pv[0] != lastBestMove) {
@@ -437,21 +723,21 @@ void Thread::search() {
       }
 
       // Have we found a "mate in x"?
-      if (   Limits.mate
+      if (   engine.limits.mate
           && bestValue >= VALUE_MATE_IN_MAX_PLY
-          && VALUE_MATE - bestValue <= 2 * Limits.mate)
-          Threads.stop = true;
+          && VALUE_MATE - bestValue <= 2 * engine.limits.mate)
+          engine.threads.stop = true;
 
       if (!mainThread)
           continue;
 
       // If skill level is enabled and time is up, pick a sub-optimal best move
       if (skill.enabled() && skill.time_to_pick(rootDepth))
-          skill.pick_best(multiPV);
+          skill.pick_best(rootMoves, multiPV);
 
       // Do we have time for the next iteration? Can we stop searching now?
-      if (    Limits.use_time_management()
-          && !Threads.stop
+      if (    engine.limits.use_time_management()
+          && !engine.threads.stop
           && !mainThread->stopOnPonderhit)
       {
           double fallingEval = (318 + 6 * (mainThread->bestPreviousScore - bestValue)
@@ -463,14 +749,14 @@ void Thread::search() {
           double reduction = (1.47 + mainThread->previousTimeReduction) / (2.32 * timeReduction);
 
           // Use part of the gained time from a previous stable move for the current move
-          for (Thread* th : Threads)
+          for (Thread* th : engine.threads)
           {
               totBestMoveChanges += th->bestMoveChanges;
               th->bestMoveChanges = 0;
           }
           double bestMoveInstability = 1.073 + std::max(1.0, 2.25 - 9.9 / rootDepth)
-                                              * totBestMoveChanges / Threads.size();
-          double totalTime = Time.optimum() * fallingEval * reduction * bestMoveInstability;
+                                              * totBestMoveChanges / engine.threads.size();
+          double totalTime = engine.time.optimum() * fallingEval * reduction * bestMoveInstability;
 
           // Cap used time in case of a single legal move for a better viewer experience in tournaments
           // yielding correct scores and sufficiently fast moves.
@@ -478,21 +764,21 @@ void Thread::search() {
               totalTime = std::min(500.0, totalTime);
 
           // Stop the search if we have exceeded the totalTime
-          if (Time.elapsed() > totalTime)
+          if (engine.time.elapsed() > totalTime)
           {
               // If we are allowed to ponder do not stop the search now but
               // keep pondering until the GUI sends "ponderhit" or "stop".
               if (mainThread->ponder)
                   mainThread->stopOnPonderhit = true;
               else
-                  Threads.stop = true;
+                  engine.threads.stop = true;
           }
-          else if (   Threads.increaseDepth
+          else if (   engine.threads.increaseDepth
                    && !mainThread->ponder
-                   && Time.elapsed() > totalTime * 0.58)
-                   Threads.increaseDepth = false;
+                   && engine.time.elapsed() > totalTime * 0.58)
+                   engine.threads.increaseDepth = false;
           else
-                   Threads.increaseDepth = true;
+                   engine.threads.increaseDepth = true;
       }
 
       mainThread->iterValue[iterIdx] = bestValue;
@@ -507,7 +793,7 @@ void Thread::search() {
   // If skill level is enabled, swap best PV line with the sub-optimal one
   if (skill.enabled())
       std::swap(rootMoves[0], *std::find(rootMoves.begin(), rootMoves.end(),
-                skill.best ? skill.best : skill.pick_best(multiPV)));
+                skill.best ? skill.best : skill.pick_best(rootMoves, multiPV)));
 }
 
 
@@ -545,7 +831,6 @@ namespace {
 
     Move pv[MAX_PLY+1], capturesSearched[32], quietsSearched[64];
     StateInfo st;
-    ASSERT_ALIGNED(&st, Eval::NNUE::CacheLineSize);
 
     TTEntry* tte;
     Key posKey;
@@ -560,6 +845,7 @@ namespace {
 
     // Step 1. Initialize node
     Thread* thisThread = pos.this_thread();
+    Engine& engine     = thisThread->engine;
     ss->inCheck        = pos.checkers();
     priorCapture       = pos.captured_piece();
     Color us           = pos.side_to_move();
@@ -567,8 +853,13 @@ namespace {
     bestValue          = -VALUE_INFINITE;
     maxValue           = VALUE_INFINITE;
 
-    // Check for the available remaining time
-    if (thisThread == Threads.main())
+    // Check for the available remaining time, or the nodes of a batch position.
+    // A batch position always completes depth 1 to have a move to report.
+    if (thisThread->batch)
+        thisThread->batchStop =   engine.limits.nodes
+                               && thisThread->completedDepth
+                               && thisThread->nodes.load(std::memory_order_relaxed) >= uint64_t(engine.limits.nodes);
+    else if (thisThread == engine.threads.main())
         static_cast<MainThread*>(thisThread)->check_time();
 
     // Used to send selDepth info to GUI (selDepth counts from 1, ply from 0)
@@ -578,7 +869,7 @@ namespace {
     if (!rootNode)
     {
         // Step 2. Check for aborted search and immediate draw
-        if (   Threads.stop.load(std::memory_order_relaxed)
+        if (   stopped(thisThread)
             || pos.is_draw(ss->ply)
             || ss->ply >= MAX_PLY)
             return (ss->ply >= MAX_PLY && !ss->inCheck) ? evaluate(pos)
@@ -617,7 +908,7 @@ namespace {
     // position key in case of an excluded move.
     excludedMove = ss->excludedMove;
     posKey = excludedMove == MOVE_NONE ? pos.key() : pos.key() ^ make_key(excludedMove);
-    tte = TT.probe(posKey, ss->ttHit);
+    tte = engine.tt.probe(posKey, ss->ttHit);
     ttValue = ss->ttHit ? value_from_tt(tte->value(), ss->ply, pos.rule50_count()) : VALUE_NONE;
     ttMove =  rootNode ? thisThread->rootMoves[thisThread->pvIdx].pv[0]
             : ss->ttHit    ? tte->move() : MOVE_NONE;
@@ -673,12 +964,12 @@ namespace {
     }
 
     // Step 5. Tablebases probe
-    if (!rootNode && TB::Cardinality)
+    if (!rootNode && engine.tbConfig.cardinality)
     {
         int piecesCount = pos.count<ALL_PIECES>();
 
-        if (    piecesCount <= TB::Cardinality
-            && (piecesCount <  TB::Cardinality || depth >= TB::ProbeDepth)
+        if (    piecesCount <= engine.tbConfig.cardinality
+            && (piecesCount <  engine.tbConfig.cardinality || depth >= engine.tbConfig.probeDepth)
             &&  pos.rule50_count() == 0
             && !pos.can_castle(ANY_CASTLING))
         {
@@ -686,14 +977,14 @@ namespace {
             TB::WDLScore wdl = Tablebases::probe_wdl(pos, &err);
 
             // Force check of time on the next occasion
-            if (thisThread == Threads.main())
+            if (thisThread == engine.threads.main())
                 static_cast<MainThread*>(thisThread)->callsCnt = 0;
 
             if (err != TB::ProbeState::FAIL)
             {
                 thisThread->tbHits.fetch_add(1, std::memory_order_relaxed);
 
-                int drawScore = TB::UseRule50 ? 1 : 0;
+                int drawScore = engine.tbConfig.useRule50 ? 1 : 0;
 
                 // use the range VALUE_MATE_IN_MAX_PLY to VALUE_TB_WIN_IN_MAX_PLY to score
                 value =  wdl < -drawScore ? VALUE_MATED_IN_MAX_PLY + ss->ply + 1
@@ -708,7 +999,7 @@ namespace {
                 {
                     tte->save(posKey, value_to_tt(value, ss->ply), ss->ttPv, b,
                               std::min(MAX_PLY - 1, depth + 6),
-                              MOVE_NONE, VALUE_NONE);
+                              MOVE_NONE, VALUE_NONE, engine.tt.generation());
 
                     return value;
                 }
@@ -752,6 +1043,20 @@ namespace {
     }
     else
     {
+        // Futility pruning on the PSQT estimate of the NNUE, before paying for
+        // the full evaluation. The TT entry is left without a static evaluation.
+        if (   !PvNode
+            &&  thisThread->psqtPrescreen
+            &&  depth < 9
+            && (ss-1)->currentMove != MOVE_NULL)
+        {
+            eval = Eval::evaluate_psqt(pos) - PsqtPrescreenMargin;
+
+            if (   eval - futility_margin(depth, false) >= beta
+                && eval < VALUE_KNOWN_WIN)
+                return eval;
+        }
+
         // In case of null move search use previous static eval with a different sign
         // and addition of two tempos
         if ((ss-1)->currentMove != MOVE_NULL)
@@ -760,7 +1065,7 @@ namespace {
             ss->staticEval = eval = -(ss-1)->staticEval;
 
         // Save static evaluation into transposition table
-        tte->save(posKey, VALUE_NONE, ss->ttPv, BOUND_NONE, DEPTH_NONE, MOVE_NONE, eval);
+        tte->save(posKey, VALUE_NONE, ss->ttPv, BOUND_NONE, DEPTH_NONE, MOVE_NONE, eval, engine.tt.generation());
     }
 
     // Use static evaluation difference to improve quiet move ordering
@@ -894,7 +1199,7 @@ namespace {
                        && ttValue != VALUE_NONE))
                         tte->save(posKey, value_to_tt(value, ss->ply), ttPv,
                             BOUND_LOWER,
-                            depth - 3, move, ss->staticEval);
+                            depth - 3, move, ss->staticEval, engine.tt.generation());
                     return value;
                 }
             }
@@ -974,8 +1279,8 @@ moves_loop: // When in check, search starts from here
 
       ss->moveCount = ++moveCount;
 
-      if (rootNode && thisThread == Threads.main() && Time.elapsed() > 3000)
-          sync_cout << "info depth " << depth
+      if (rootNode && thisThread == engine.threads.main() && !thisThread->batch && engine.time.elapsed() > 3000)
+          engine.out << IO_LOCK << "info depth " << depth
                     << " currmove " << UCI::move(move, pos.is_chess960())
                     << " currmovenumber " << moveCount + thisThread->pvIdx << sync_endl;
       if (PvNode)
@@ -1105,7 +1410,7 @@ moves_loop: // When in check, search starts from here
       ss->doubleExtensions = (ss-1)->doubleExtensions + (extension == 2);
 
       // Speculative prefetch as early as possible
-      prefetch(TT.first_entry(pos.key_after(move)));
+      prefetch(engine.tt.first_entry(pos.key_after(move)));
 
       // Update the current move (this must be done after singular extension search)
       ss->currentMove = move;
@@ -1230,7 +1535,7 @@ moves_loop: // When in check, search starts from here
       // Finished searching the move. If a stop occurred, the return value of
       // the search cannot be trusted, and we return immediately without
       // updating best move, PV and TT.
-      if (Threads.stop.load(std::memory_order_relaxed))
+      if (stopped(thisThread))
           return VALUE_ZERO;
 
       if (rootNode)
@@ -1298,7 +1603,7 @@ moves_loop: // When in check, search starts from here
     // completed. But in this case bestValue is valid because we have fully
     // searched our subtree, and we can anyhow save the result in TT.
     /*
-       if (Threads.stop)
+       if (engine.threads.stop)
         return VALUE_DRAW;
     */
 
@@ -1341,7 +1646,7 @@ moves_loop: // When in check, search starts from here
         tte->save(posKey, value_to_tt(bestValue, ss->ply), ss->ttPv,
                   bestValue >= beta ? BOUND_LOWER :
                   PvNode && bestMove ? BOUND_EXACT : BOUND_UPPER,
-                  depth, bestMove, ss->staticEval);
+                  depth, bestMove, ss->staticEval, engine.tt.generation());
 
     assert(bestValue > -VALUE_INFINITE && bestValue < VALUE_INFINITE);
 
@@ -1363,7 +1668,6 @@ moves_loop: // When in check, search starts from here
 
     Move pv[MAX_PLY+1];
     StateInfo st;
-    ASSERT_ALIGNED(&st, Eval::NNUE::CacheLineSize);
 
     TTEntry* tte;
     Key posKey;
@@ -1381,6 +1685,7 @@ moves_loop: // When in check, search starts from here
     }
 
     Thread* thisThread = pos.this_thread();
+    Engine& engine = thisThread->engine;
     bestMove = MOVE_NONE;
     ss->inCheck = pos.checkers();
     moveCount = 0;
@@ -1399,7 +1704,7 @@ moves_loop: // When in check, search starts from here
                                                   : DEPTH_QS_NO_CHECKS;
     // Transposition table lookup
     posKey = pos.key();
-    tte = TT.probe(posKey, ss->ttHit);
+    tte = engine.tt.probe(posKey, ss->ttHit);
     ttValue = ss->ttHit ? value_from_tt(tte->value(), ss->ply, pos.rule50_count()) : VALUE_NONE;
     ttMove = ss->ttHit ? tte->move() : MOVE_NONE;
     pvHit = ss->ttHit && tte->is_pv();
@@ -1432,11 +1737,21 @@ moves_loop: // When in check, search starts from here
                 bestValue = ttValue;
         }
         else
+        {
+            // Stand pat on the PSQT estimate of the NNUE when it is well above
+            // beta, before paying for the full evaluation.
+            if (   !PvNode
+                &&  thisThread->psqtPrescreen
+                && (ss-1)->currentMove != MOVE_NULL
+                && (bestValue = Eval::evaluate_psqt(pos) - PsqtPrescreenMargin) >= beta)
+                return bestValue;
+
             // In case of null move search use previous static eval with a different sign
             // and addition of two tempos
             ss->staticEval = bestValue =
             (ss-1)->currentMove != MOVE_NULL ? evaluate(pos)
                                              : -(ss-1)->staticEval;
+        }
 
         // Stand pat. Return immediately if static value is at least beta
         if (bestValue >= beta)
@@ -1444,7 +1759,7 @@ moves_loop: // When in check, search starts from here
             // Save gathered info in transposition table
             if (!ss->ttHit)
                 tte->save(posKey, value_to_tt(bestValue, ss->ply), false, BOUND_LOWER,
-                          DEPTH_NONE, MOVE_NONE, ss->staticEval);
+                          DEPTH_NONE, MOVE_NONE, ss->staticEval, engine.tt.generation());
 
             return bestValue;
         }
@@ -1509,7 +1824,7 @@ moves_loop: // When in check, search starts from here
           continue;
 
       // Speculative prefetch as early as possible
-      prefetch(TT.first_entry(pos.key_after(move)));
+      prefetch(engine.tt.first_entry(pos.key_after(move)));
 
       // Check for legality just before making the move
       if (!pos.legal(move))
@@ -1571,7 +1886,7 @@ moves_loop: // When in check, search starts from here
     tte->save(posKey, value_to_tt(bestValue, ss->ply), pvHit,
               bestValue >= beta ? BOUND_LOWER :
               PvNode && bestValue > oldAlpha  ? BOUND_EXACT : BOUND_UPPER,
-              ttDepth, bestMove, ss->staticEval);
+              ttDepth, bestMove, ss->staticEval, engine.tt.generation());
 
     assert(bestValue > -VALUE_INFINITE && bestValue < VALUE_INFINITE);
 
@@ -1732,9 +2047,8 @@ moves_loop: // When in check, search starts from here
   // When playing with strength handicap, choose best move among a set of RootMoves
   // using a statistical rule dependent on 'level'. Idea by Heinz van Saanen.
 
-  Move Skill::pick_best(size_t multiPV) {
+  Move Skill::pick_best(const RootMoves& rootMoves, size_t multiPV) {
 
-    const RootMoves& rootMoves = Threads.main()->rootMoves;
     static PRNG rng(now()); // PRNG sequence should be non-deterministic
 
     // RootMoves are already sorted by score in descending order
@@ -1774,12 +2088,12 @@ void MainThread::check_time() {
       return;
 
   // When using nodes, ensure checking rate is not lower than 0.1% of nodes
-  callsCnt = Limits.nodes ? std::min(1024, int(Limits.nodes / 1024)) : 1024;
+  callsCnt = engine.limits.nodes ? std::min(1024, int(engine.limits.nodes / 1024)) : 1024;
 
   static TimePoint lastInfoTime = now();
 
-  TimePoint elapsed = Time.elapsed();
-  TimePoint tick = Limits.startTime + elapsed;
+  TimePoint elapsed = engine.time.elapsed();
+  TimePoint tick = engine.limits.startTime + elapsed;
 
   if (tick - lastInfoTime >= 1000)
   {
@@ -1791,10 +2105,10 @@ void MainThread::check_time() {
   if (ponder)
       return;
 
-  if (   (Limits.use_time_management() && (elapsed > Time.maximum() - 10 || stopOnPonderhit))
-      || (Limits.movetime && elapsed >= Limits.movetime)
-      || (Limits.nodes && Threads.nodes_searched() >= (uint64_t)Limits.nodes))
-      Threads.stop = true;
+  if (   (engine.limits.use_time_management() && (elapsed > engine.time.maximum() - 10 || stopOnPonderhit))
+      || (engine.limits.movetime && elapsed >= engine.limits.movetime)
+      || (engine.limits.nodes && engine.threads.nodes_searched() >= (uint64_t)engine.limits.nodes))
+      engine.threads.stop = true;
 }
 
 
@@ -1804,12 +2118,13 @@ void MainThread::check_time() {
 string UCI::pv(const Position& pos, Depth depth, Value alpha, Value beta) {
 
   std::stringstream ss;
-  TimePoint elapsed = Time.elapsed() + 1;
+  Engine& engine = pos.this_thread()->engine;
+  TimePoint elapsed = engine.time.elapsed() + 1;
   const RootMoves& rootMoves = pos.this_thread()->rootMoves;
   size_t pvIdx = pos.this_thread()->pvIdx;
-  size_t multiPV = std::min((size_t)Options["MultiPV"], rootMoves.size());
-  uint64_t nodesSearched = Threads.nodes_searched();
-  uint64_t tbHits = Threads.tb_hits() + (TB::RootInTB ? rootMoves.size() : 0);
+  size_t multiPV = std::min((size_t)engine.options["MultiPV"], rootMoves.size());
+  uint64_t nodesSearched = engine.threads.nodes_searched();
+  uint64_t tbHits = engine.threads.tb_hits() + (engine.tbConfig.rootInTB ? rootMoves.size() : 0);
 
   for (size_t i = 0; i < multiPV; ++i)
   {
@@ -1824,7 +2139,7 @@ string UCI::pv(const Position& pos, Depth depth, Value alpha, Value beta) {
       if (v == -VALUE_INFINITE)
           v = VALUE_ZERO;
 
-      bool tb = TB::RootInTB && abs(v) < VALUE_MATE_IN_MAX_PLY;
+      bool tb = engine.tbConfig.rootInTB && abs(v) < VALUE_MATE_IN_MAX_PLY;
       v = tb ? rootMoves[i].tbScore : v;
 
       if (ss.rdbuf()->in_avail()) // Not at first line
@@ -1836,7 +2151,7 @@ string UCI::pv(const Position& pos, Depth depth, Value alpha, Value beta) {
          << " multipv "  << i + 1
          << " score "    << UCI::value(v);
 
-      if (Options["UCI_ShowWDL"])
+      if (engine.options["UCI_ShowWDL"])
           ss << UCI::wdl(v, pos.game_ply());
 
       if (!tb && i == pvIdx)
@@ -1846,7 +2161,7 @@ string UCI::pv(const Position& pos, Depth depth, Value alpha, Value beta) {
          << " nps "      << nodesSearched * 1000 / elapsed;
 
       if (elapsed > 1000) // Earlier makes little sense
-          ss << " hashfull " << TT.hashfull();
+          ss << " hashfull " << engine.tt.hashfull();
 
       ss << " tbhits "   << tbHits
          << " time "     << elapsed
@@ -1868,7 +2183,6 @@ string UCI::pv(const Position& pos, Depth depth, Value alpha, Value beta) {
 bool RootMove::extract_ponder_from_tt(Position& pos) {
 
     StateInfo st;
-    ASSERT_ALIGNED(&st, Eval::NNUE::CacheLineSize);
 
     bool ttHit;
 
@@ -1878,7 +2192,7 @@ bool RootMove::extract_ponder_from_tt(Position& pos) {
         return false;
 
     pos.do_move(pv[0], st);
-    TTEntry* tte = TT.probe(pos.key(), ttHit);
+    TTEntry* tte = pos.this_thread()->engine.tt.probe(pos.key(), ttHit);
 
     if (ttHit)
     {
@@ -1891,36 +2205,50 @@ bool RootMove::extract_ponder_from_tt(Position& pos) {
     return pv.size() > 1;
 }
 
-void Tablebases::rank_root_moves(Position& pos, Search::RootMoves& rootMoves) {
+/// Tablebases::probe_config() returns the parameters of the probes done in
+/// search, read from the UCI options of the engine.
 
-    RootInTB = false;
-    UseRule50 = bool(Options["Syzygy50MoveRule"]);
-    ProbeDepth = int(Options["SyzygyProbeDepth"]);
-    Cardinality = int(Options["SyzygyProbeLimit"]);
-    bool dtz_available = true;
+Tablebases::Config Tablebases::probe_config(UCI::OptionsMap& options) {
+
+    Config config;
+
+    config.useRule50 = bool(options["Syzygy50MoveRule"]);
+    config.probeDepth = int(options["SyzygyProbeDepth"]);
+    config.cardinality = int(options["SyzygyProbeLimit"]);
 
     // Tables with fewer pieces than SyzygyProbeLimit are searched with
-    // ProbeDepth == DEPTH_ZERO
-    if (Cardinality > MaxCardinality)
+    // probeDepth == DEPTH_ZERO
+    if (config.cardinality > MaxCardinality)
     {
-        Cardinality = MaxCardinality;
-        ProbeDepth = 0;
+        config.cardinality = MaxCardinality;
+        config.probeDepth = 0;
     }
 
-    if (Cardinality >= popcount(pos.pieces()) && !pos.can_castle(ANY_CASTLING))
+    return config;
+}
+
+/// Tablebases::rank_root_moves() ranks the root moves with the tablebases and
+/// returns the probe parameters for the search that follows.
+
+Tablebases::Config Tablebases::rank_root_moves(UCI::OptionsMap& options, Position& pos, Search::RootMoves& rootMoves) {
+
+    Config config = probe_config(options);
+    bool dtz_available = true;
+
+    if (config.cardinality >= popcount(pos.pieces()) && !pos.can_castle(ANY_CASTLING))
     {
         // Rank moves using DTZ tables
-        RootInTB = root_probe(pos, rootMoves);
+        config.rootInTB = root_probe(pos, rootMoves, config.useRule50);
 
-        if (!RootInTB)
+        if (!config.rootInTB)
         {
             // DTZ tables are missing; try to rank moves using WDL tables
             dtz_available = false;
-            RootInTB = root_probe_wdl(pos, rootMoves);
+            config.rootInTB = root_probe_wdl(pos, rootMoves, config.useRule50);
         }
     }
 
-    if (RootInTB)
+    if (config.rootInTB)
     {
         // Sort moves according to TB rank
         std::stable_sort(rootMoves.begin(), rootMoves.end(),
@@ -1928,7 +2256,7 @@ void Tablebases::rank_root_moves(Position& pos, Search::RootMoves& rootMoves) {
 
         // Probe during search only if DTZ is not available and we are winning
         if (dtz_available || rootMoves[0].tbScore <= VALUE_DRAW)
-            Cardinality = 0;
+            config.cardinality = 0;
     }
     else
     {
@@ -1936,6 +2264,8 @@ void Tablebases::rank_root_moves(Position& pos, Search::RootMoves& rootMoves) {
         for (auto& m : rootMoves)
             m.tbRank = 0;
     }
+
+    return config;
 }
 
 } // namespace Stockfish
@@ -19,6 +19,7 @@
 #ifndef SEARCH_H_INCLUDED
 #define SEARCH_H_INCLUDED
 
+#include <string>
 #include <vector>
 
 #include "misc.h"
@@ -27,6 +28,7 @@
 
 namespace Stockfish {
 
+class Engine;
 class Position;
 
 namespace Search {
@@ -102,10 +104,9 @@ struct LimitsType {
   int64_t nodes;
 };
 
-extern LimitsType Limits;
-
 void init();
-void clear();
+void clear(Engine& engine);
+void start_batch(Engine& engine, const std::vector<std::string>& positions, const LimitsType& limits);
 
 } // namespace Search
 
@@ -19,6 +19,7 @@
 #include <cassert>
 
 #include <algorithm> // For std::count
+#include "engine.h"
 #include "movegen.h"
 #include "search.h"
 #include "thread.h"
@@ -28,13 +29,10 @@
 
 namespace Stockfish {
 
-ThreadPool Threads; // Global object
-
-
 /// Thread constructor launches the thread and waits until it goes to sleep
 /// in idle_loop(). Note that 'searching' and 'exit' should be already set.
 
-Thread::Thread(size_t n) : idx(n), stdThread(&Thread::idle_loop, this) {
+Thread::Thread(Engine& e, size_t n) : idx(n), engine(e), stdThread(&Thread::idle_loop, this) {
 
   wait_for_search_finished();
 }
@@ -61,6 +59,16 @@ void Thread::clear() {
   mainHistory.fill(0);
   lowPlyHistory.fill(0);
   captureHistory.fill(0);
+  accumulatorCaches.clear();
+  evalCache.resize(size_t(engine.options["Eval Cache"]));
+
+#ifdef TT_STATS
+  ttStats = {};
+#endif
+
+#ifdef NNUE_STATS
+  nnueStats = {};
+#endif
 
   for (bool inCheck : { false, true })
       for (StatsType c : { NoCaptures, Captures })
@@ -83,13 +91,30 @@ void Thread::start_searching() {
 }
 
 
+/// Thread::start_custom_job() wakes up the thread that will run the given
+/// function instead of searching. If the thread is busy, it waits for the
+/// thread to finish first. Completion is waited for as for a search.
+
+void Thread::start_custom_job(std::function<void()> f) {
+
+  {
+      std::unique_lock<std::mutex> lk(mutex);
+      cv.wait(lk, [&]{ return !searching; });
+      jobFunc = std::move(f);
+      searching = runningJob = true;
+  }
+  cv.notify_one(); // Wake up the thread in idle_loop()
+}
+
+
 /// Thread::wait_for_search_finished() blocks on the condition variable
-/// until the thread has finished searching.
+/// until the thread has finished searching. Without jobs, it returns at once
+/// if the thread is running a custom job instead.
 
-void Thread::wait_for_search_finished() {
+void Thread::wait_for_search_finished(bool jobs) {
 
   std::unique_lock<std::mutex> lk(mutex);
-  cv.wait(lk, [&]{ return !searching; });
+  cv.wait(lk, [&]{ return !searching || (!jobs && runningJob); });
 }
 
 
@@ -103,22 +128,41 @@ void Thread::idle_loop() {
   // some Windows NUMA hardware, for instance in fishtest. To make it simple,
   // just check if running threads are below a threshold, in this case all this
   // NUMA machinery is not needed.
-  if (Options["Threads"] > 8)
-      WinProcGroup::bindThisThread(idx);
+  if (engine.options["Threads"] > 8)
+  {
+      numaNode = WinProcGroup::bindThisThread(idx);
+
+      // Move our own data, mostly the history tables, to the node we are bound to
+      WinProcGroup::bindToThisNode(this, sizeof(Thread));
+  }
+
+#ifdef TT_STATS
+  TTStats::local = &ttStats;
+#endif
+
+#ifdef NNUE_STATS
+  Eval::NNUE::NnueStats::local = &nnueStats;
+#endif
 
   while (true)
   {
       std::unique_lock<std::mutex> lk(mutex);
-      searching = false;
+      searching = runningJob = false;
       cv.notify_one(); // Wake up anyone waiting for search finished
       cv.wait(lk, [&]{ return searching; });
 
       if (exit)
           return;
 
+      std::function<void()> job = std::move(jobFunc);
+      jobFunc = nullptr;
+
       lk.unlock();
 
-      search();
+      if (job)
+          job();
+      else
+          search();
   }
 }
 
@@ -131,6 +175,8 @@ void ThreadPool::set(size_t requested) {
   if (size() > 0)   // destroy any existing thread(s)
   {
       main()->wait_for_search_finished();
+      engine.tt.stop_clear();
+      wait_for_jobs_finished();
 
       while (size() > 0)
           delete back(), pop_back();
@@ -138,27 +184,56 @@ void ThreadPool::set(size_t requested) {
 
   if (requested > 0)   // create new thread(s)
   {
-      push_back(new MainThread(0));
+      push_back(new MainThread(engine, 0));
 
       while (size() < requested)
-          push_back(new Thread(size()));
+          push_back(new Thread(engine, size()));
       clear();
 
       // Reallocate the hash with the new threadpool size
-      TT.resize(size_t(Options["Hash"]));
-
-      // Init thread number dependent search params.
-      Search::init();
+      engine.tt.resize(size_t(engine.options["Hash"]));
   }
 }
 
 
-/// ThreadPool::clear() sets threadPool data to initial values
+/// ThreadPool::clear() sets threadPool data to initial values. Each thread
+/// resets its own histories in the background, which also places them on the
+/// memory of its NUMA node, see start_job(). With clearHash, the threads then
+/// zero the transposition table in the same job. Commands using the thread
+/// data wait only for the resets, see wait_for_threads_cleared(), and a search
+/// stops the zeroing and leaves the remaining slices of the table to probe().
 
-void ThreadPool::clear() {
+void ThreadPool::clear(bool clearHash) {
 
-  for (Thread* th : *this)
-      th->clear();
+  if (clearHash)
+  {
+      engine.tt.stop_clear();
+      wait_for_jobs_finished();
+      engine.tt.start_clear();
+  }
+
+  {
+      std::lock_guard<std::mutex> lk(clearMutex);
+      pendingClears = size();
+  }
+
+  start_job([this, clearHash](size_t idx) {
+
+      (*this)[idx]->clear();
+
+      {
+          std::unique_lock<std::mutex> lk(clearMutex);
+          --pendingClears;
+          clearCv.notify_all();
+
+          // Zero the hash once all the threads are done, so that the resets are
+          // not slowed down by the zeroing when there are fewer cores than threads.
+          clearCv.wait(lk, [&]{ return pendingClears == 0; });
+      }
+
+      if (clearHash)
+          engine.tt.clear_slices();
+  });
 
   main()->callsCnt = 0;
   main()->bestPreviousScore = VALUE_INFINITE;
@@ -172,12 +247,15 @@ void ThreadPool::clear() {
 void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
                                 const Search::LimitsType& limits, bool ponderMode) {
 
-  main()->wait_for_search_finished();
+  // Jobs started by ucinewgame may still be running on any thread. Stop the
+  // zeroing of the hash, whose remaining slices are then zeroed on first probe.
+  engine.tt.stop_clear();
+  wait_for_jobs_finished();
 
   main()->stopOnPonderhit = stop = false;
   increaseDepth = true;
   main()->ponder = ponderMode;
-  Search::Limits = limits;
+  engine.limits = limits;
   Search::RootMoves rootMoves;
 
   for (const auto& m : MoveList<LEGAL>(pos))
@@ -186,7 +264,7 @@ void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
           rootMoves.emplace_back(m);
 
   if (!rootMoves.empty())
-      Tablebases::rank_root_moves(pos, rootMoves);
+      engine.tbConfig = Tablebases::rank_root_moves(engine.options, pos, rootMoves);
 
   // After ownership transfer 'states' becomes empty, so if we stop the search
   // and call 'go' again without setting a new position states.get() == NULL.
@@ -199,14 +277,18 @@ void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
   // some StateInfo fields (previous, pliesFromNull, capturedPiece) that cannot
   // be deduced from a fen string, so set() clears them and they are set from
   // setupStates->back() later. The rootState is per thread, earlier states are shared
-  // since they are read-only.
+  // since they are read-only. The rootState keeps the accumulator given by set(),
+  // which is in the stack of its thread.
   for (Thread* th : *this)
   {
       th->nodes = th->tbHits = th->nmpMinPly = th->bestMoveChanges = 0;
+      th->evalCache.probes = th->evalCache.hits = 0;
       th->rootDepth = th->completedDepth = 0;
       th->rootMoves = rootMoves;
       th->rootPos.set(pos.fen(), pos.is_chess960(), &th->rootState, th);
+      Eval::NNUE::Accumulator* accumulator = th->rootState.accumulator;
       th->rootState = setupStates->back();
+      th->rootState.accumulator = accumulator;
   }
 
   main()->start_searching();
@@ -263,4 +345,49 @@ void ThreadPool::wait_for_search_finished() const {
             th->wait_for_search_finished();
 }
 
+
+/// ThreadPool::start_job() runs job(idx) on every thread of the pool, where idx
+/// is the index of the thread, and returns immediately. This is used for bulk
+/// initialization, like clearing the hash table or the histories, which then
+/// runs on threads that are already created and bound to their NUMA node.
+/// Anything depending on the job must first call wait_for_jobs_finished().
+
+void ThreadPool::start_job(const std::function<void(size_t)>& job) {
+
+    for (Thread* th : *this)
+        th->start_custom_job([job, th]() { job(th->id()); });
+}
+
+
+/// ThreadPool::run_job() runs job(idx) on every thread of the pool and waits
+/// for completion.
+
+void ThreadPool::run_job(const std::function<void(size_t)>& job) {
+
+    start_job(job);
+    wait_for_jobs_finished();
+}
+
+
+/// Wait for all threads, main thread included, to have finished their job
+
+void ThreadPool::wait_for_jobs_finished() const {
+
+    for (Thread* th : *this)
+        th->wait_for_search_finished();
+}
+
+
+/// ThreadPool::wait_for_threads_cleared() waits for a running search, and until
+/// all the threads have reset their data in the jobs started by clear(), while
+/// they may still be zeroing the transposition table.
+
+void ThreadPool::wait_for_threads_cleared() {
+
+    main()->wait_for_search_finished(false);
+
+    std::unique_lock<std::mutex> lk(clearMutex);
+    clearCv.wait(lk, [&]{ return pendingClears == 0; });
+}
+
 } // namespace Stockfish
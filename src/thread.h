@@ -21,23 +21,30 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <functional>
 #include <mutex>
 #include <thread>
 #include <vector>
 
 #include "material.h"
 #include "movepick.h"
+#include "nnue/nnue_eval_cache.h"
 #include "pawns.h"
 #include "position.h"
 #include "search.h"
 #include "thread_win32_osx.h"
+#include "tt.h"
 
 namespace Stockfish {
 
+class Engine;
+
 /// Thread class keeps together all the thread-related stuff. We use
 /// per-thread pawn and material hash tables so that once we get a
 /// pointer to an entry its life time is unlimited and we don't have
 /// to care about someone changing the entry under our feet.
+/// The NNUE accumulators and their caches, and the evaluation cache, are
+/// per-thread for the same reason.
 
 class Thread {
 
@@ -45,20 +52,26 @@ class Thread {
   std::condition_variable cv;
   size_t idx;
   bool exit = false, searching = true; // Set before starting std::thread
-  NativeThread stdThread;
+  bool runningJob = false;
+  std::function<void()> jobFunc;
 
 public:
-  explicit Thread(size_t);
+  Thread(Engine&, size_t);
   virtual ~Thread();
   virtual void search();
   void clear();
   void idle_loop();
   void start_searching();
-  void wait_for_search_finished();
+  void start_custom_job(std::function<void()> f);
+  void wait_for_search_finished(bool jobs = true);
   size_t id() const { return idx; }
 
+  Engine& engine;
   Pawns::Table pawnsTable;
   Material::Table materialTable;
+  Eval::NNUE::AccumulatorStack accumulatorStack;
+  Eval::NNUE::AccumulatorCaches accumulatorCaches;
+  Eval::NNUE::EvalCache evalCache;
   size_t pvIdx, pvLast;
   uint64_t ttHitAverage;
   int selDepth, nmpMinPly;
@@ -75,6 +88,21 @@ public:
   CapturePieceToHistory captureHistory;
   ContinuationHistory continuationHistory[2][2];
   Score trend;
+  bool batch = false, batchStop = false; // Searching alone a position of 'go batch'
+  bool psqtPrescreen; // Prune with Eval::evaluate_psqt() before the full evaluation
+  bool prefetchWeights = false; // Position::do_move() calls Eval::NNUE::prefetch_weights(), set by each search
+  int numaNode = -1;  // Node the thread is bound to, see idle_loop()
+
+#ifdef TT_STATS
+  TTStats ttStats;
+#endif
+
+#ifdef NNUE_STATS
+  Eval::NNUE::NnueStats nnueStats;
+#endif
+
+private:
+  NativeThread stdThread; // Last, so that all the members are set before starting
 };
 
 
@@ -102,8 +130,10 @@ struct MainThread : public Thread {
 
 struct ThreadPool : public std::vector<Thread*> {
 
+  explicit ThreadPool(Engine& e) : engine(e) {}
+
   void start_thinking(Position&, StateListPtr&, const Search::LimitsType&, bool = false);
-  void clear();
+  void clear(bool clearHash = false);
   void set(size_t);
 
   MainThread* main()        const { return static_cast<MainThread*>(front()); }
@@ -112,11 +142,20 @@ struct ThreadPool : public std::vector<Thread*> {
   Thread* get_best_thread() const;
   void start_searching();
   void wait_for_search_finished() const;
+  void start_job(const std::function<void(size_t)>& job);
+  void run_job(const std::function<void(size_t)>& job);
+  void wait_for_jobs_finished() const;
+  void wait_for_threads_cleared();
 
-  std::atomic_bool stop, increaseDepth;
+  std::atomic_bool stop = false, increaseDepth = true;
+  std::atomic_bool batching = false; // A 'go batch' is running, see Search::start_batch()
 
 private:
+  Engine& engine;
   StateListPtr setupStates;
+  std::mutex clearMutex;
+  std::condition_variable clearCv;
+  size_t pendingClears = 0; // Threads still resetting their data, see clear()
 
   uint64_t accumulate(std::atomic<uint64_t> Thread::* member) const {
 
@@ -127,8 +166,6 @@ private:
   }
 };
 
-extern ThreadPool Threads;
-
 } // namespace Stockfish
 
 #endif // #ifndef THREAD_H_INCLUDED
@@ -20,14 +20,13 @@
 #include <cfloat>
 #include <cmath>
 
+#include "engine.h"
 #include "search.h"
 #include "timeman.h"
 #include "uci.h"
 
 namespace Stockfish {
 
-TimeManagement Time; // Our global time management object
-
 
 /// TimeManagement::init() is called at the beginning of the search and calculates
 /// the bounds of time allowed for the current game ply. We currently support:
@@ -36,9 +35,9 @@ TimeManagement Time; // Our global time management object
 
 void TimeManagement::init(Search::LimitsType& limits, Color us, int ply) {
 
-  TimePoint moveOverhead    = TimePoint(Options["Move Overhead"]);
-  TimePoint slowMover       = TimePoint(Options["Slow Mover"]);
-  TimePoint npmsec          = TimePoint(Options["nodestime"]);
+  TimePoint moveOverhead    = TimePoint(engine.options["Move Overhead"]);
+  TimePoint slowMover       = TimePoint(engine.options["Slow Mover"]);
+  TimePoint npmsec          = TimePoint(engine.options["nodestime"]);
 
   // optScale is a percentage of available time to use for the current move.
   // maxScale is a multiplier applied to optimumTime.
@@ -94,8 +93,17 @@ void TimeManagement::init(Search::LimitsType& limits, Color us, int ply) {
   optimumTime = TimePoint(optScale * timeLeft);
   maximumTime = TimePoint(std::min(0.8 * limits.time[us] - moveOverhead, maxScale * optimumTime));
 
-  if (Options["Ponder"])
+  if (engine.options["Ponder"])
       optimumTime += optimumTime / 4;
 }
 
+
+/// TimeManagement::elapsed() returns the time spent on the search, in nodes
+/// when in 'nodes as time' mode.
+
+TimePoint TimeManagement::elapsed() const {
+
+  return engine.limits.npmsec ? TimePoint(engine.threads.nodes_searched()) : now() - startTime;
+}
+
 } // namespace Stockfish
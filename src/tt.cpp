@@ -17,10 +17,15 @@
 */
 
 #include <cstring>   // For std::memset
+#include <limits>
+#include <numeric>   // For std::gcd
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <thread>
 
 #include "bitboard.h"
+#include "engine.h"
 #include "misc.h"
 #include "thread.h"
 #include "tt.h"
@@ -28,28 +33,107 @@
 
 namespace Stockfish {
 
-TranspositionTable TT; // Our global transposition table
+#ifdef TT_STATS
+thread_local TTStats* TTStats::local = nullptr;
+#  define TT_STAT(counter, n) (TTStats::local ? void(TTStats::local->counter += (n)) : void())
+#else
+#  define TT_STAT(counter, n) void()
+#endif
+
+namespace {
+
+  // Header of a transposition table snapshot file. The clusters follow it as
+  // a raw dump in native byte order, so a snapshot can only be loaded by an
+  // engine built for the same architecture with the same TT layout.
+  struct TTFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t clusterBytes;
+    uint32_t clusterSize;
+    uint64_t clusterCount;
+    uint8_t  generation8;
+    uint8_t  padding[7];
+  };
+
+  constexpr uint32_t TTFileMagic   = 0x54544653; // "SFTT" on little endian
+  constexpr uint32_t TTFileVersion = 1;
+
+  // Snapshots are streamed in chunks of this many bytes
+  constexpr size_t TTFileChunk = 64 * 1024 * 1024;
+}
+
+namespace {
+
+  // ClusterMap finds the clusters of a table of dstCount clusters that may hold
+  // the keys of a cluster of a table of srcCount clusters. Clusters are indexed
+  // with mul_hi64(key, count), so the keys of cluster s of the source go to the
+  // clusters from floor(s * dstCount / srcCount) to ceil((s + 1) * dstCount /
+  // srcCount) - 1, a single one when shrinking and at most
+  // ceil(dstCount / srcCount) + 1 when growing. The ratio is reduced by the gcd
+  // of the counts, which are multiples of a power of two as they come from
+  // sizes in MB, so that nothing overflows. The bounds are exact as long as
+  // den * dstCount < 2^64, otherwise no cluster is mapped.
+
+  class ClusterMap {
+
+    uint64_t num, den;
+    bool valid;
+
+  public:
+    ClusterMap(uint64_t srcCount, uint64_t dstCount) {
+
+      const uint64_t g = std::gcd(srcCount, dstCount);
+      num = dstCount / g;
+      den = srcCount / g;
+      valid = den <= std::numeric_limits<uint64_t>::max() / dstCount;
+    }
+
+    bool operator()(size_t srcIdx, size_t& first, size_t& last) const {
+
+      const uint64_t s = srcIdx, t = s + 1;
+      const uint64_t r = t % den * num;
+
+      first = size_t(s / den * num + s % den * num / den);
+      last  = size_t(t / den * num + r / den + (r % den != 0) - 1);
+      return valid;
+    }
+  };
+
+} // namespace
+
 
 /// TTEntry::save() populates the TTEntry with a new node's data, possibly
-/// overwriting an old position. Update is not atomic and can be racy.
+/// overwriting an old position. Update is not atomic and can be racy. The
+/// generation is the current one of the table, see TranspositionTable::generation().
 
-void TTEntry::save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev) {
+void TTEntry::save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev, uint8_t gen) {
 
   // Preserve any existing move for the same position
-  if (m || (uint16_t)k != key16)
+  if (m || (TTKey)k != keyBits)
       move16 = (uint16_t)m;
 
   // Overwrite less valuable entries (cheapest checks first)
   if (b == BOUND_EXACT
-      || (uint16_t)k != key16
+      || (TTKey)k != keyBits
       || d - DEPTH_OFFSET > depth8 - 4)
   {
       assert(d > DEPTH_OFFSET);
       assert(d < 256 + DEPTH_OFFSET);
 
-      key16     = (uint16_t)k;
+#ifdef TT_STATS
+      if (!depth8)
+          TT_STAT(emptyFills, 1);
+      else if ((TTKey)k == keyBits)
+          TT_STAT(updates, 1);
+      else if ((genBound8 & TranspositionTable::GENERATION_MASK) != gen)
+          TT_STAT(ageReplacements, 1);
+      else
+          TT_STAT(depthReplacements, 1);
+#endif
+
+      keyBits   = (TTKey)k;
       depth8    = (uint8_t)(d - DEPTH_OFFSET);
-      genBound8 = (uint8_t)(TT.generation8 | uint8_t(pv) << 2 | b);
+      genBound8 = (uint8_t)(gen | uint8_t(pv) << 2 | b);
       value16   = (int16_t)v;
       eval16    = (int16_t)ev;
   }
@@ -59,16 +143,59 @@ void TTEntry::save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev)
 /// TranspositionTable::resize() sets the size of the transposition table,
 /// measured in megabytes. Transposition table consists of a power of 2 number
 /// of clusters and each cluster consists of ClusterSize number of TTEntry.
+/// If the "Shared Hash" option names a segment, the table is mapped from POSIX
+/// shared memory instead, so that cooperating engine processes using the same
+/// name and Hash size share their entries. Entries are already written racily
+/// and verified through keyBits, so no further synchronization is needed.
+/// The entries of the previous table are migrated into a new private table,
+/// so that changing Hash does not throw away the analysis done so far.
 
 void TranspositionTable::resize(size_t mbSize) {
 
-  Threads.main()->wait_for_search_finished();
+  engine.threads.main()->wait_for_search_finished();
+  stop_clear();
+  engine.threads.wait_for_jobs_finished();
+  finish_clear(); // Slices not zeroed yet would migrate stale entries
 
-  aligned_large_pages_free(table);
+  Cluster* oldTable = table;
+  size_t oldCount = clusterCount;
+  bool oldShared = shared;
 
   clusterCount = mbSize * 1024 * 1024 / sizeof(Cluster);
+  table = nullptr;
+  shared = false;
+  sliceCount = 0;
+
+  std::string shmName = engine.options["Shared Hash"];
+
+  if (!shmName.empty() && shmName != "<empty>")
+  {
+      table = static_cast<Cluster*>(shared_memory_alloc(shmName, clusterCount * sizeof(Cluster)));
+      shared = table != nullptr;
+
+      if (shared)
+      {
+          // A newly created segment is already zeroed, and an existing one
+          // must keep the entries stored by the other processes.
+          free_table(oldTable, oldCount, oldShared);
+          engine.out << IO_LOCK << "info string Using shared hash " << shmName << sync_endl;
+          return;
+      }
+
+      engine.out << IO_LOCK << "info string Failed to map shared hash " << shmName
+                            << " of " << mbSize << "MB, using a private table" << sync_endl;
+  }
 
   table = static_cast<Cluster*>(aligned_large_pages_alloc(clusterCount * sizeof(Cluster)));
+
+  // If there is no room for both tables, give up on the old entries
+  if (!table && oldTable)
+  {
+      free_table(oldTable, oldCount, oldShared);
+      oldTable = nullptr;
+      table = static_cast<Cluster*>(aligned_large_pages_alloc(clusterCount * sizeof(Cluster)));
+  }
+
   if (!table)
   {
       std::cerr << "Failed to allocate " << mbSize
@@ -76,37 +203,299 @@ void TranspositionTable::resize(size_t mbSize) {
       exit(EXIT_FAILURE);
   }
 
+  huge_pages_report(engine.out, "Hash", table);
+
+  // The table is accessed uniformly by all the threads, so on NUMA systems
+  // spread it across the nodes instead of following the first-touch policy.
+  if (engine.options["Threads"] > 8)
+      WinProcGroup::interleave(table, clusterCount * sizeof(Cluster));
+
+  sliceCount = (clusterCount + SliceClusters - 1) / SliceClusters;
+  sliceState.reset(new std::atomic<uint8_t>[sliceCount]);
   clear();
+
+  if (oldTable)
+  {
+      migrate_all(oldTable, oldCount);
+      free_table(oldTable, oldCount, oldShared);
+  }
+}
+
+
+/// TranspositionTable::migrate_all() rehashes all the entries of a table made
+/// of srcCount clusters into the current table, in a multi-threaded way.
+
+void TranspositionTable::migrate_all(const Cluster* src, size_t srcCount) {
+
+  const ClusterMap map(srcCount, clusterCount);
+
+  engine.threads.run_job([this, src, srcCount, &map](size_t idx) {
+
+      // Each thread will migrate its part of the old table. Neighbouring
+      // threads may write the same cluster at the boundaries of their parts,
+      // which is just as racy as a search.
+      const size_t stride = size_t(srcCount / engine.threads.size()),
+                   start  = size_t(stride * idx),
+                   len    = idx != engine.threads.size() - 1 ?
+                            stride : srcCount - start;
+
+      for (size_t i = start, first, last; i < start + len; ++i)
+          if (map(i, first, last))
+              for (size_t dstIdx = first; dstIdx <= last; ++dstIdx)
+                  migrate(src[i], dstIdx);
+  });
+}
+
+
+/// TranspositionTable::free_table() releases the memory of a table, whether
+/// it is private or a shared memory segment.
+
+void TranspositionTable::free_table(Cluster* mem, size_t count, bool isShared) {
+
+  if (isShared)
+      shared_memory_free(mem, count * sizeof(Cluster));
+  else
+      aligned_large_pages_free(mem);
 }
 
 
 /// TranspositionTable::clear() initializes the entire transposition table to zero,
-//  in a multi-threaded way.
+//  in a multi-threaded way, and returns once done. A shared table is left
+//  untouched, as other processes may still be using its entries.
 
 void TranspositionTable::clear() {
 
-  std::vector<std::thread> threads;
+  start_clear();
+  finish_clear();
+}
+
+
+/// TranspositionTable::start_clear() marks all the slices of the table as to
+/// be zeroed, which is then done by clear_slices() on the pool threads or by
+/// probe() on first access. No clearing must be running, see stop_clear().
+
+void TranspositionTable::start_clear() {
+
+  if (shared || !sliceCount)
+      return;
+
+  for (size_t s = 0; s < sliceCount; ++s)
+      sliceState[s].store(SLICE_DIRTY, std::memory_order_relaxed);
+
+  nextSlice = clearedSlices = 0;
+  clearing = true;
+}
+
+
+/// TranspositionTable::clear_slices() zeroes slices until none is left to be
+/// claimed. It is run by the pool threads, so that the zeroing is shared among
+/// them, and returns early after stop_clear().
+
+void TranspositionTable::clear_slices() {
+
+  for (size_t s; (s = nextSlice++) < sliceCount; )
+      clear_slice(s);
+}
+
+
+/// TranspositionTable::stop_clear() makes the pool threads return from
+/// clear_slices() once done with their current slice, so that a search can
+/// start. The remaining slices are zeroed by probe() when first accessed.
+
+void TranspositionTable::stop_clear() {
+
+  nextSlice = sliceCount;
+}
+
+
+/// TranspositionTable::finish_clear() zeroes the remaining slices on the pool
+/// threads and returns once the whole table is cleared.
+
+void TranspositionTable::finish_clear() {
+
+  if (!clearing)
+      return;
+
+  nextSlice = 0;
+  engine.threads.run_job([this](size_t) { clear_slices(); });
+}
+
+
+/// TranspositionTable::clear_slice() zeroes the given slice if no other thread
+/// did or is doing it, otherwise waits for that thread to be done.
 
-  for (size_t idx = 0; idx < Options["Threads"]; ++idx)
+void TranspositionTable::clear_slice(size_t slice) const {
+
+  uint8_t state = SLICE_DIRTY;
+
+  if (sliceState[slice].compare_exchange_strong(state, SLICE_CLEARING, std::memory_order_acquire))
+  {
+      const size_t start = slice * SliceClusters,
+                   len   = std::min(SliceClusters, clusterCount - start);
+
+      std::memset(&table[start], 0, len * sizeof(Cluster));
+      sliceState[slice].store(SLICE_CLEAN, std::memory_order_release);
+
+      if (++clearedSlices == sliceCount)
+          clearing = false;
+  }
+  else
+      while (state != SLICE_CLEAN)
+      {
+          std::this_thread::yield();
+          state = sliceState[slice].load(std::memory_order_acquire);
+      }
+}
+
+
+/// TranspositionTable::migrate() copies the non-empty entries of a cluster of
+/// another table into the cluster dstIdx of the current table, one of those
+/// that may hold the keys of the source cluster, see ClusterMap. Only the low
+/// bits of the keys are stored, so when growing the table, the entries are
+/// copied into all these clusters. The copy in the cluster of its key is found
+/// by probe(), and the others are replaced like any entry of an older search.
+/// Within the destination, the usual replacement rule decides.
+
+void TranspositionTable::migrate(const Cluster& src, size_t dstIdx) {
+
+  TTEntry* const tte = table[dstIdx].entry;
+
+  auto value = [&](const TTEntry* t) {
+      return t->depth8 - ((GENERATION_CYCLE + generation8 - t->genBound8) & GENERATION_MASK);
+  };
+
+  for (const TTEntry& e : src.entry)
+  {
+      if (!e.depth8)
+          continue;
+
+      TTEntry* replace = tte;
+      for (int i = 0; i < ClusterSize; ++i)
+      {
+          if (tte[i].keyBits == e.keyBits || !tte[i].depth8)
+          {
+              replace = &tte[i];
+              break;
+          }
+          if (value(&tte[i]) < value(replace))
+              replace = &tte[i];
+      }
+
+      if (   !replace->depth8
+          || replace->keyBits == e.keyBits
+          || value(replace) < value(&e))
+          *replace = e;
+  }
+}
+
+
+/// TranspositionTable::save() writes a snapshot of the transposition table to
+/// the given file, so that it can be reloaded by a later session.
+
+bool TranspositionTable::save(const std::string& fileName) {
+
+  engine.threads.main()->wait_for_search_finished();
+  engine.threads.wait_for_jobs_finished();
+  finish_clear();
+
+  TTFileHeader header {};
+  header.magic        = TTFileMagic;
+  header.version      = TTFileVersion;
+  header.clusterBytes = sizeof(Cluster);
+  header.clusterSize  = ClusterSize;
+  header.clusterCount = clusterCount;
+  header.generation8  = generation8;
+
+  std::ofstream file(fileName, std::ios::binary);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  const char* data = reinterpret_cast<const char*>(table);
+  const size_t total = clusterCount * sizeof(Cluster);
+
+  for (size_t done = 0; file && done < total; done += TTFileChunk)
+      file.write(data + done, std::streamsize(std::min(TTFileChunk, total - done)));
+
+  bool saved = bool(file);
+
+  engine.out << IO_LOCK << (saved ? "Transposition table saved successfully to " + fileName
+                                  : "Failed to save transposition table to " + fileName) << sync_endl;
+  return saved;
+}
+
+
+/// TranspositionTable::load() restores a snapshot written by save(). If the
+/// snapshot was taken with another Hash size, its entries are rehashed into
+/// the current table instead of resizing it, as done by resize(). The table is
+/// left untouched if the file is missing or incompatible, and cleared if it is
+/// truncated. A shared table is never loaded, as other processes may be using
+/// its entries.
+
+bool TranspositionTable::load(const std::string& fileName) {
+
+  engine.threads.main()->wait_for_search_finished();
+
+  if (shared)
+  {
+      engine.out << IO_LOCK << "Failed to load transposition table: "
+                               "a shared table cannot be loaded" << sync_endl;
+      return false;
+  }
+
+  std::ifstream file(fileName, std::ios::binary);
+  TTFileHeader header {};
+
+  if (   !file.read(reinterpret_cast<char*>(&header), sizeof(header))
+      || header.magic != TTFileMagic
+      || header.version != TTFileVersion
+      || header.clusterBytes != sizeof(Cluster)
+      || header.clusterSize != ClusterSize
+      || header.clusterCount == 0)
+  {
+      engine.out << IO_LOCK << "Failed to load transposition table: "
+                            << fileName << " is not a compatible snapshot" << sync_endl;
+      return false;
+  }
+
+  stop_clear();
+  engine.threads.wait_for_jobs_finished();
+  clear();
+  generation8 = header.generation8;
+
+  bool loaded = true;
+
+  if (header.clusterCount == clusterCount)
+  {
+      char* data = reinterpret_cast<char*>(table);
+      const size_t total = clusterCount * sizeof(Cluster);
+
+      for (size_t done = 0; loaded && done < total; done += TTFileChunk)
+          loaded = bool(file.read(data + done, std::streamsize(std::min(TTFileChunk, total - done))));
+  }
+  else
   {
-      threads.emplace_back([this, idx]() {
+      const ClusterMap map(header.clusterCount, clusterCount);
+      std::vector<Cluster> buffer(TTFileChunk / sizeof(Cluster));
 
-          // Thread binding gives faster search on systems with a first-touch policy
-          if (Options["Threads"] > 8)
-              WinProcGroup::bindThisThread(idx);
+      for (size_t done = 0; loaded && done < header.clusterCount; done += buffer.size())
+      {
+          const size_t len = std::min(buffer.size(), size_t(header.clusterCount - done));
 
-          // Each thread will zero its part of the hash table
-          const size_t stride = size_t(clusterCount / Options["Threads"]),
-                       start  = size_t(stride * idx),
-                       len    = idx != Options["Threads"] - 1 ?
-                                stride : clusterCount - start;
+          loaded = bool(file.read(reinterpret_cast<char*>(buffer.data()),
+                                  std::streamsize(len * sizeof(Cluster))));
 
-          std::memset(&table[start], 0, len * sizeof(Cluster));
-      });
+          for (size_t i = 0, first, last; loaded && i < len; ++i)
+              if (map(done + i, first, last))
+                  for (size_t dstIdx = first; dstIdx <= last; ++dstIdx)
+                      migrate(buffer[i], dstIdx);
+      }
   }
 
-  for (std::thread& th : threads)
-      th.join();
+  if (!loaded)
+      clear();
+
+  engine.out << IO_LOCK << (loaded ? "Transposition table loaded successfully from " + fileName
+                                   : "Failed to load transposition table: " + fileName + " is truncated") << sync_endl;
+  return loaded;
 }
 
 
@@ -119,17 +508,27 @@ void TranspositionTable::clear() {
 
 TTEntry* TranspositionTable::probe(const Key key, bool& found) const {
 
-  TTEntry* const tte = first_entry(key);
-  const uint16_t key16 = (uint16_t)key;  // Use the low 16 bits as key inside the cluster
+  const size_t idx = mul_hi64(key, clusterCount);
+  ensure_cleared(idx);
+
+  TTEntry* const tte = &table[idx].entry[0];
+  const TTKey keyBits = (TTKey)key;  // Use the low bits as key inside the cluster
+
+  TT_STAT(probes, 1);
 
   for (int i = 0; i < ClusterSize; ++i)
-      if (tte[i].key16 == key16 || !tte[i].depth8)
+      if (tte[i].keyBits == keyBits || !tte[i].depth8)
       {
           tte[i].genBound8 = uint8_t(generation8 | (tte[i].genBound8 & (GENERATION_DELTA - 1))); // Refresh
 
+          TT_STAT(keyChecks, i);
+          TT_STAT(hits, bool(tte[i].depth8));
+
           return found = (bool)tte[i].depth8, &tte[i];
       }
 
+  TT_STAT(keyChecks, ClusterSize);
+
   // Find an entry to be replaced according to the replacement strategy
   TTEntry* replace = tte;
   for (int i = 1; i < ClusterSize; ++i)
@@ -146,11 +545,60 @@ TTEntry* TranspositionTable::probe(const Key key, bool& found) const {
 }
 
 
+/// TranspositionTable::stats() returns a report of the transposition table
+/// activity of all the search threads since the last ucinewgame. Each keyBits
+/// comparison against an entry of another position matches with probability
+/// 2^-16 (2^-32 with TT_CLUSTER64), which gives an estimate of the number of
+/// false hits.
+
+std::string TranspositionTable::stats() const {
+
+#ifdef TT_STATS
+  TTStats total {};
+
+  for (Thread* th : engine.threads)
+  {
+      total.probes            += th->ttStats.probes;
+      total.hits              += th->ttStats.hits;
+      total.emptyFills        += th->ttStats.emptyFills;
+      total.depthReplacements += th->ttStats.depthReplacements;
+      total.ageReplacements   += th->ttStats.ageReplacements;
+      total.updates           += th->ttStats.updates;
+      total.keyChecks         += th->ttStats.keyChecks;
+  }
+
+  auto percent = [&](uint64_t n) { return total.probes ? 100.0 * n / total.probes : 0.0; };
+  const double keyValues = double(uint64_t(1) << (8 * sizeof(TTKey)));
+
+  std::stringstream ss;
+  ss << std::fixed;
+  ss.precision(2);
+
+  ss << "Probes            : " << total.probes
+     << "\nHits              : " << total.hits << " (" << percent(total.hits) << "%)"
+     << "\nEmpty slot fills  : " << total.emptyFills
+     << "\nReplaced by depth : " << total.depthReplacements
+     << "\nReplaced by age   : " << total.ageReplacements
+     << "\nSame key updates  : " << total.updates
+     << "\nKey checks        : " << total.keyChecks
+     << "\nEst. false hits   : " << total.keyChecks / keyValues
+     << " (" << percent(total.keyChecks) * 10000 / keyValues << " per million probes)"
+     << "\nHashfull          : " << hashfull() << " permill";
+
+  return ss.str();
+#else
+  return "Transposition table statistics are not available, build with ttstats=yes";
+#endif
+}
+
+
 /// TranspositionTable::hashfull() returns an approximation of the hashtable
 /// occupation during a search. The hash is x permill full, as per UCI protocol.
 
 int TranspositionTable::hashfull() const {
 
+  ensure_cleared(0); // The first 1000 clusters lie in the first slice
+
   int cnt = 0;
   for (int i = 0; i < 1000; ++i)
       for (int j = 0; j < ClusterSize; ++j)
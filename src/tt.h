@@ -19,14 +19,31 @@
 #ifndef TT_H_INCLUDED
 #define TT_H_INCLUDED
 
+#include <atomic>
+#include <memory>
+#include <string>
+
 #include "misc.h"
 #include "types.h"
 
 namespace Stockfish {
 
-/// TTEntry struct is the 10 bytes transposition table entry, defined as below:
+class Engine;
+
+/// TTKey holds the bits of the position key stored in a TTEntry to verify it
+/// within a cluster. Wider keys make false hits rarer at the cost of fewer
+/// entries per byte, see TT_CLUSTER64.
+
+#ifdef TT_CLUSTER64
+typedef uint32_t TTKey;
+#else
+typedef uint16_t TTKey;
+#endif
+
+/// TTEntry struct is the 10 bytes transposition table entry (12 bytes with
+/// TT_CLUSTER64), defined as below:
 ///
-/// key        16 bit
+/// key        16 bit (32 bit with TT_CLUSTER64)
 /// depth       8 bit
 /// generation  5 bit
 /// pv node     1 bit
@@ -43,12 +60,12 @@ struct TTEntry {
   Depth depth() const { return (Depth)depth8 + DEPTH_OFFSET; }
   bool is_pv()  const { return (bool)(genBound8 & 0x4); }
   Bound bound() const { return (Bound)(genBound8 & 0x3); }
-  void save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev);
+  void save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev, uint8_t gen);
 
 private:
   friend class TranspositionTable;
 
-  uint16_t key16;
+  TTKey    keyBits;
   uint8_t  depth8;
   uint8_t  genBound8;
   uint16_t move16;
@@ -57,22 +74,59 @@ private:
 };
 
 
+#ifdef TT_STATS
+
+/// TTStats holds the counters of the transposition table activity of a search
+/// thread. They are only collected when compiling with ttstats=yes, so that
+/// the hot path is unchanged otherwise. TTStats::local points to the counters
+/// of the calling thread, or is null for threads outside of the pool.
+
+struct TTStats {
+  uint64_t probes, hits, emptyFills, depthReplacements, ageReplacements, updates, keyChecks;
+
+  static thread_local TTStats* local;
+};
+
+#endif
+
+
 /// A TranspositionTable is an array of Cluster, of size clusterCount. Each
 /// cluster consists of ClusterSize number of TTEntry. Each non-empty TTEntry
 /// contains information on exactly one position. The size of a Cluster should
 /// divide the size of a cache line for best performance, as the cacheline is
-/// prefetched when possible.
+/// prefetched when possible. By default a cluster holds 3 entries in 32 bytes.
+/// Building with ttcluster=64 defines TT_CLUSTER64, which selects clusters of
+/// 5 entries with 32 bit keys filling a whole 64 bytes cache line, to reduce
+/// false hits with huge tables.
+///
+/// The table is cleared by slices of SliceBytes, so that a clearing started in
+/// the background by ucinewgame does not have to be finished before searching:
+/// probe() zeroes the slice of a cluster on first access, or waits for the pool
+/// thread already zeroing it.
 
 class TranspositionTable {
 
+#ifdef TT_CLUSTER64
+  static constexpr int ClusterSize = 5;
+  static constexpr int ClusterBytes = 64;
+#else
   static constexpr int ClusterSize = 3;
+  static constexpr int ClusterBytes = 32;
+#endif
 
   struct Cluster {
     TTEntry entry[ClusterSize];
-    char padding[2]; // Pad to 32 bytes
+    char padding[ClusterBytes - ClusterSize * sizeof(TTEntry)]; // Pad to ClusterBytes
   };
 
-  static_assert(sizeof(Cluster) == 32, "Unexpected Cluster size");
+  static_assert(sizeof(Cluster) == ClusterBytes, "Unexpected Cluster size");
+
+  static constexpr size_t SliceBytes = 2 * 1024 * 1024;
+  static constexpr size_t SliceClusters = SliceBytes / sizeof(Cluster);
+
+  static_assert(SliceClusters >= 1000, "hashfull() expects its clusters in the first slice");
+
+  enum SliceState : uint8_t { SLICE_DIRTY, SLICE_CLEARING, SLICE_CLEAN };
 
   // Constants used to refresh the hash table periodically
   static constexpr unsigned GENERATION_BITS  = 3;                                // nb of bits reserved for other things
@@ -81,12 +135,20 @@ class TranspositionTable {
   static constexpr int      GENERATION_MASK  = (0xFF << GENERATION_BITS) & 0xFF; // mask to pull out generation number
 
 public:
- ~TranspositionTable() { aligned_large_pages_free(table); }
+  explicit TranspositionTable(Engine& e) : engine(e) {}
+ ~TranspositionTable() { free_table(table, clusterCount, shared); }
   void new_search() { generation8 += GENERATION_DELTA; } // Lower bits are used for other things
+  uint8_t generation() const { return generation8; }
   TTEntry* probe(const Key key, bool& found) const;
   int hashfull() const;
   void resize(size_t mbSize);
   void clear();
+  void start_clear();
+  void clear_slices();
+  void stop_clear();
+  std::string stats() const;
+  bool save(const std::string& fileName);
+  bool load(const std::string& fileName);
 
   TTEntry* first_entry(const Key key) const {
     return &table[mul_hi64(key, clusterCount)].entry[0];
@@ -95,12 +157,29 @@ public:
 private:
   friend struct TTEntry;
 
-  size_t clusterCount;
-  Cluster* table;
-  uint8_t generation8; // Size must be not bigger than TTEntry::genBound8
-};
+  // Zeroes the slice of cluster idx if a clearing is still pending
+  void ensure_cleared(size_t idx) const {
+    if (clearing.load(std::memory_order_acquire))
+        clear_slice(idx / SliceClusters);
+  }
 
-extern TranspositionTable TT;
+  void clear_slice(size_t slice) const;
+  void finish_clear();
+
+  void migrate(const Cluster& src, size_t dstIdx);
+  void migrate_all(const Cluster* src, size_t srcCount);
+  static void free_table(Cluster* mem, size_t count, bool isShared);
+
+  Engine& engine;
+  size_t clusterCount = 0;
+  Cluster* table = nullptr;
+  bool shared = false; // Table is a shared memory segment, see resize()
+  size_t sliceCount = 0;
+  std::unique_ptr<std::atomic<uint8_t>[]> sliceState;
+  mutable std::atomic<size_t> nextSlice = 0, clearedSlices = 0;
+  mutable std::atomic<bool> clearing = false;
+  uint8_t generation8 = 0; // Size must be not bigger than TTEntry::genBound8
+};
 
 } // namespace Stockfish
 
@@ -26,6 +26,8 @@
 
 namespace Stockfish {
 
+class Engine;
+
 typedef std::pair<int, int> Range; // Option's min-max values
 typedef Range (RangeFun) (int);
 
@@ -145,7 +147,7 @@ public:
   static int add(const std::string& names, Args&&... args) {
     return instance().add(SetDefaultRange, names.substr(1, names.size() - 2), args...); // Remove trailing parenthesis
   }
-  static void init() { for (auto& e : instance().list) e->init_option(); read_options(); } // Deferred, due to UCI::Options access
+  static void init(Engine& engine); // Deferred, due to UCI options access
   static void read_options() { for (auto& e : instance().list) e->read_option(); }
   static bool update_on_last;
 };
@@ -35,6 +35,10 @@
 ///
 /// -DUSE_PEXT    | Add runtime support for use of pext asm-instruction. Works
 ///               | only in 64-bit mode and requires hardware with pext support.
+///
+/// -DUSE_DISPATCH | Select at startup the NNUE code for the instruction sets of
+///               | the CPU, and use pext only if the CPU has a fast one. Needs
+///               | gcc or clang, and the NNUE variants built by the Makefile.
 
 #include <cassert>
 #include <cctype>
@@ -79,6 +83,8 @@
 #if defined(USE_PEXT)
 #  include <immintrin.h> // Header for _pext_u64() intrinsic
 #  define pext(b, m) _pext_u64(b, m)
+#elif defined(USE_DISPATCH) && defined(IS_64BIT)
+#  define pext(b, m) pext_asm(b, m) // The intrinsic needs -mbmi2
 #else
 #  define pext(b, m) 0
 #endif
@@ -93,6 +99,16 @@ constexpr bool HasPopCnt = false;
 
 #ifdef USE_PEXT
 constexpr bool HasPext = true;
+#elif defined(USE_DISPATCH) && defined(IS_64BIT)
+extern const bool HasPext; // Set at startup from the CPU, see bitboard.cpp
+
+// The assembler knows pext whatever the target flags, and the instruction is
+// only reached when HasPext is set.
+inline uint64_t pext_asm(uint64_t b, uint64_t m) {
+  uint64_t r;
+  asm("pextq %2, %1, %0" : "=r" (r) : "r" (b), "r" (m));
+  return r;
+}
 #else
 constexpr bool HasPext = false;
 #endif
@@ -18,10 +18,13 @@
 
 #include <cassert>
 #include <cmath>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <thread>
 
+#include "engine.h"
 #include "evaluate.h"
 #include "movegen.h"
 #include "position.h"
@@ -37,6 +40,8 @@ using namespace std;
 namespace Stockfish {
 
 extern vector<string> setup_bench(const Position&, istream&);
+extern bool read_positions(const string&, vector<string>&);
+extern string epd_id(const string&);
 
 namespace {
 
@@ -49,7 +54,7 @@ namespace {
   // or the starting position ("startpos") and then makes the moves given in the
   // following move list ("moves").
 
-  void position(Position& pos, istringstream& is, StateListPtr& states) {
+  void position(Engine& engine, istringstream& is) {
 
     Move m;
     string token, fen;
@@ -67,8 +72,11 @@ namespace {
     else
         return;
 
+    Position& pos = engine.pos;
+    StateListPtr& states = engine.states;
+
     states = StateListPtr(new std::deque<StateInfo>(1)); // Drop old and create a new one
-    pos.set(fen, Options["UCI_Chess960"], &states->back(), Threads.main());
+    pos.set(fen, engine.options["UCI_Chess960"], &states->back(), engine.threads.main());
 
     // Parse move list (if any)
     while (is >> token && (m = UCI::to_move(pos, token)) != MOVE_NONE)
@@ -81,22 +89,82 @@ namespace {
   // trace_eval() prints the evaluation for the current position, consistent with the UCI
   // options set so far.
 
-  void trace_eval(Position& pos) {
+  void trace_eval(Engine& engine) {
 
     StateListPtr states(new std::deque<StateInfo>(1));
     Position p;
-    p.set(pos.fen(), Options["UCI_Chess960"], &states->back(), Threads.main());
+    p.set(engine.pos.fen(), engine.options["UCI_Chess960"], &states->back(), engine.threads.main());
+
+    Eval::NNUE::verify(engine);
+
+    engine.out << IO_LOCK << "\n" << Eval::trace(p) << sync_endl;
+  }
+
+
+  // eval_batch() is called when engine receives the "eval batch" command. It
+  // evaluates the positions of a file with the NNUE, all at once, and prints
+  // the value of each of them from the point of view of the side to move.
+
+  void eval_batch(Engine& engine, const string& fileName) {
+
+    vector<string> fens;
+
+    Eval::NNUE::verify(engine);
+
+    if (!Eval::useNNUE)
+    {
+        engine.out << IO_LOCK << "info string NNUE evaluation is disabled" << sync_endl;
+        return;
+    }
+
+    if (!read_positions(fileName, fens))
+    {
+        engine.out << IO_LOCK << "info string Unable to open file " << fileName << sync_endl;
+        return;
+    }
+
+    bool chess960 = engine.options["UCI_Chess960"];
+    vector<StateInfo> states(fens.size());
+    vector<Position> positions(fens.size());
+    vector<const Position*> list;
+    vector<Value> values(fens.size());
+
+    for (size_t i = 0; i < fens.size(); ++i)
+    {
+        positions[i].set(fens[i], chess960, &states[i], engine.threads.main());
+        list.push_back(&positions[i]);
+    }
 
-    Eval::NNUE::verify();
+    TimePoint start = now();
+    Eval::NNUE::evaluate_batch(list.data(), list.size(), values.data(), true);
+    TimePoint elapsed = now() - start + 1;
 
-    sync_cout << "\n" << Eval::trace(p) << sync_endl;
+    std::stringstream ss;
+
+    for (size_t i = 0; i < fens.size(); ++i)
+    {
+        string id = epd_id(fens[i]);
+
+        ss << "batch " << i + 1;
+
+        if (!id.empty())
+            ss << " id " << id;
+
+        ss << " score " << UCI::value(values[i]) << "\n";
+    }
+
+    ss << "batch done positions " << fens.size()
+       << " time " << elapsed
+       << " evals/s " << fens.size() * 1000 / elapsed;
+
+    engine.out << IO_LOCK << ss.str() << sync_endl;
   }
 
 
   // setoption() is called when engine receives the "setoption" UCI command. The
   // function updates the UCI option ("name") to the given value ("value").
 
-  void setoption(istringstream& is) {
+  void setoption(Engine& engine, istringstream& is) {
 
     string token, name, value;
 
@@ -110,10 +178,15 @@ namespace {
     while (is >> token)
         value += (value.empty() ? "" : " ") + token;
 
-    if (Options.count(name))
-        Options[name] = value;
-    else
-        sync_cout << "No such option: " << name << sync_endl;
+    if (!engine.options.count(name))
+        engine.out << IO_LOCK << "No such option: " << name << sync_endl;
+
+    else if (!UCI::is_shared(name))
+        engine.options[name] = value;
+
+    else if (!Engine::set_shared_option(engine.options[name], value))
+        engine.out << IO_LOCK << "info string " << name << " is shared by all the engines"
+                                 " and cannot be changed while other engines exist" << sync_endl;
   }
 
 
@@ -121,10 +194,10 @@ namespace {
   // the thinking time and other parameters from the input string, then starts
   // the search.
 
-  void go(Position& pos, istringstream& is, StateListPtr& states) {
+  void go(Engine& engine, istringstream& is) {
 
     Search::LimitsType limits;
-    string token;
+    string token, batchFile;
     bool ponderMode = false;
 
     limits.startTime = now(); // As early as possible!
@@ -132,7 +205,7 @@ namespace {
     while (is >> token)
         if (token == "searchmoves") // Needs to be the last command on the line
             while (is >> token)
-                limits.searchmoves.push_back(UCI::to_move(pos, token));
+                limits.searchmoves.push_back(UCI::to_move(engine.pos, token));
 
         else if (token == "wtime")     is >> limits.time[WHITE];
         else if (token == "btime")     is >> limits.time[BLACK];
@@ -146,21 +219,31 @@ namespace {
         else if (token == "perft")     is >> limits.perft;
         else if (token == "infinite")  limits.infinite = 1;
         else if (token == "ponder")    ponderMode = true;
+        else if (token == "batch")     is >> batchFile;
+
+    if (!batchFile.empty())
+    {
+        vector<string> positions;
+
+        if (read_positions(batchFile, positions))
+            Search::start_batch(engine, positions, limits);
+        else
+            engine.out << IO_LOCK << "info string Unable to open file " << batchFile << sync_endl;
+        return;
+    }
 
-    Threads.start_thinking(pos, states, limits, ponderMode);
+    engine.threads.start_thinking(engine.pos, engine.states, limits, ponderMode);
   }
 
 
-  // bench() is called when engine receives the "bench" command. Firstly
-  // a list of UCI commands is setup according to bench parameters, then
-  // it is run one by one printing a summary at the end.
+  // run_bench() runs one by one the UCI commands set up by setup_bench(), and
+  // returns the number of nodes searched and the time elapsed since ucinewgame.
 
-  void bench(Position& pos, istream& args, StateListPtr& states) {
+  std::pair<uint64_t, TimePoint> run_bench(Engine& engine, const vector<string>& list) {
 
     string token;
     uint64_t num, nodes = 0, cnt = 1;
 
-    vector<string> list = setup_bench(pos, args);
     num = count_if(list.begin(), list.end(), [](string s) { return s.find("go ") == 0 || s.find("eval") == 0; });
 
     TimePoint elapsed = now();
@@ -172,31 +255,220 @@ namespace {
 
         if (token == "go" || token == "eval")
         {
-            cerr << "\nPosition: " << cnt++ << '/' << num << " (" << pos.fen() << ")" << endl;
+            cerr << "\nPosition: " << cnt++ << '/' << num << " (" << engine.pos.fen() << ")" << endl;
             if (token == "go")
             {
-               go(pos, is, states);
-               Threads.main()->wait_for_search_finished();
-               nodes += Threads.nodes_searched();
+               go(engine, is);
+               engine.threads.main()->wait_for_search_finished();
+               nodes += engine.threads.nodes_searched();
             }
             else
-               trace_eval(pos);
+               trace_eval(engine);
+        }
+        else if (token == "setoption")  setoption(engine, is);
+        else if (token == "position")   position(engine, is);
+        else if (token == "ucinewgame")
+        {
+            Search::clear(engine);
+            engine.threads.wait_for_jobs_finished(); // Clearing may take some while
+            elapsed = now();
         }
-        else if (token == "setoption")  setoption(is);
-        else if (token == "position")   position(pos, is, states);
-        else if (token == "ucinewgame") { Search::clear(); elapsed = now(); } // Search::clear() may take some while
     }
 
-    elapsed = now() - elapsed + 1; // Ensure positivity to avoid a 'divide by zero'
+    return { nodes, now() - elapsed + 1 }; // Ensure positivity to avoid a 'divide by zero'
+  }
+
+
+  // bench() is called when engine receives the "bench" command. Firstly
+  // a list of UCI commands is setup according to bench parameters, then
+  // it is run one by one printing a summary at the end.
+
+  void bench(Engine& engine, istream& args) {
+
+    auto [nodes, elapsed] = run_bench(engine, setup_bench(engine.pos, args));
 
     dbg_print(); // Just before exiting
 
+#ifdef TT_STATS
+    cerr << "\n" << engine.tt.stats() << endl;
+#endif
+
+#ifdef NNUE_STATS
+    cerr << "\n" << Eval::NNUE::stats(engine) << endl;
+#endif
+
     cerr << "\n==========================="
          << "\nTotal time (ms) : " << elapsed
          << "\nNodes searched  : " << nodes
          << "\nNodes/second    : " << 1000 * nodes / elapsed << endl;
   }
 
+  // threadbench() is called when engine receives the "threadbench" command. It
+  // runs bench with 1, 2, 4... threads up to the given maximum, then prints the
+  // speed reached with each number of threads, and the NUMA node each thread has
+  // been bound to. Threads are only bound when there are more than 8 of them,
+  // see Thread::idle_loop().
+
+  void threadbench(Engine& engine, istream& args) {
+
+    string token, ttSize, benchArgs;
+    size_t maxThreads;
+
+    ttSize     = (args >> token) ? token : "16";
+    maxThreads = (args >> token) ? size_t(stoi(token)) : std::max(1U, std::thread::hardware_concurrency());
+    benchArgs  = (args >> token) ? token : "13";
+
+    while (args >> token)
+        benchArgs += " " + token;
+
+    std::stringstream ss;
+    double nps1 = 0;
+
+    ss << "\n==========================="
+       << "\nThreads  Nodes/second  Speedup  NUMA nodes";
+
+    for (size_t threads = 1; ; threads = std::min(2 * threads, maxThreads))
+    {
+        istringstream is(ttSize + " " + std::to_string(threads) + " " + benchArgs);
+        auto [nodes, elapsed] = run_bench(engine, setup_bench(engine.pos, is));
+        double nps = 1000.0 * nodes / elapsed;
+
+        if (threads == 1)
+            nps1 = nps;
+
+        ss << "\n" << std::setw(7) << threads
+           << std::setw(14) << uint64_t(nps)
+           << std::setw(9) << std::fixed << std::setprecision(2) << nps / nps1 << " ";
+
+        // Ranges of consecutive threads bound to the same node
+        for (size_t i = 0, j; i < engine.threads.size(); i = j)
+        {
+            const int node = engine.threads[i]->numaNode;
+
+            for (j = i + 1; j < engine.threads.size() && engine.threads[j]->numaNode == node; ++j) {}
+
+            ss << " " << i;
+            if (j - 1 > i)
+                ss << "-" << j - 1;
+            ss << ":" << (node >= 0 ? std::to_string(node) : string("unbound"));
+        }
+
+        if (threads == maxThreads)
+            break;
+    }
+
+    cerr << ss.str() << endl;
+  }
+
+
+  // evalbench() is called when engine receives the "evalbench" command. It
+  // evaluates each position of a file (the bench positions by default) with
+  // the NNUE many times, and prints the number of evaluations per second. The
+  // accumulators are computed by the first evaluation of a position, so this
+  // measures the propagation through the network. Then random games are played
+  // from each position, evaluating the position after every move, to measure
+  // the incremental updates of the accumulators, once with the prefetching of
+  // the weights by do_move() and once without.
+
+  void evalbench(Engine& engine, istream& args) {
+
+    constexpr int WalkLength = 64;
+
+    string token;
+    int count = (args >> token) ? stoi(token) : 100000;
+    string fenFile = (args >> token) ? token : "default";
+    uint64_t evals = 0, updates[2] = {};
+    int64_t checksum = 0, updateChecksum[2] = {};
+    TimePoint elapsed = 0, updateElapsed[2] = {};
+    std::vector<StateInfo> states(WalkLength);
+    std::vector<Move> moves;
+    int positions = 0;
+
+    Eval::NNUE::verify(engine);
+
+    if (!Eval::useNNUE)
+    {
+        engine.out << IO_LOCK << "info string NNUE evaluation is disabled" << sync_endl;
+        return;
+    }
+
+    istringstream benchArgs("16 1 1 " + fenFile + " depth NNUE");
+
+#ifdef NNUE_STATS
+    Eval::NNUE::NnueStats stats {};
+    Eval::NNUE::NnueStats::local = &stats;
+#endif
+
+    for (const auto& cmd : setup_bench(engine.pos, benchArgs))
+    {
+        istringstream is(cmd);
+        is >> skipws >> token;
+
+        if (token != "position")
+            continue;
+
+        position(engine, is);
+
+        TimePoint start = now();
+        for (int i = 0; i < count; ++i)
+            checksum += Eval::NNUE::evaluate(engine.pos, true);
+        elapsed += now() - start;
+        evals += count;
+
+        // The same games are played with and without prefetching, in turn
+        // first, so that neither one benefits from the other warming the caches.
+        for (int k = 0; k < 2; ++k)
+        {
+            const bool prefetch = (k + positions) % 2;
+            engine.pos.this_thread()->prefetchWeights = prefetch;
+
+            start = now();
+            for (int game = 0; game < std::max(count / 1000, 1); ++game)
+            {
+                PRNG rng(game + 1);
+
+                for (int ply = 0; ply < WalkLength; ++ply)
+                {
+                    MoveList<LEGAL> legal(engine.pos);
+                    if (!legal.size())
+                        break;
+
+                    moves.push_back(*(legal.begin() + rng.rand<unsigned>() % legal.size()));
+                    engine.pos.do_move(moves.back(), states[ply]);
+                    updateChecksum[prefetch] += Eval::NNUE::evaluate(engine.pos, true);
+                    ++updates[prefetch];
+                }
+
+                for ( ; !moves.empty(); moves.pop_back())
+                    engine.pos.undo_move(moves.back());
+            }
+            updateElapsed[prefetch] += now() - start;
+        }
+        ++positions;
+    }
+
+    engine.pos.this_thread()->prefetchWeights = false;
+
+    elapsed += 1; // Ensure positivity to avoid a 'divide by zero'
+    updateElapsed[0] += 1;
+    updateElapsed[1] += 1;
+
+#ifdef NNUE_STATS
+    Eval::NNUE::NnueStats::local = nullptr;
+    cerr << "\n" << stats.report() << endl;
+#endif
+
+    cerr << "\n==========================="
+         << "\nTotal time (ms) : " << elapsed
+         << "\nEvaluations     : " << evals
+         << "\nChecksum        : " << checksum
+         << "\nEvals/second    : " << 1000 * evals / elapsed
+         << "\nMoves evaluated : " << updates[1]
+         << "\nChecksum        : " << updateChecksum[1]
+         << "\nEvals/second    : " << 1000 * updates[0] / updateElapsed[0] << " without prefetching, "
+                                  << 1000 * updates[1] / updateElapsed[1] << " with prefetching" << endl;
+  }
+
   // The win rate model returns the probability (per mille) of winning given an eval
   // and a game-ply. The model fits rather accurately the LTC fishtest statistics.
   int win_rate_model(Value v, int ply) {
@@ -226,15 +498,10 @@ namespace {
 /// function. Also intercepts EOF from stdin to ensure gracefully exiting if the
 /// GUI dies unexpectedly. When called with some command line arguments, e.g. to
 /// run 'bench', once the command is executed the function returns immediately.
-/// In addition to the UCI ones, also some additional debug commands are supported.
 
-void UCI::loop(int argc, char* argv[]) {
+void UCI::loop(Engine& engine, int argc, char* argv[]) {
 
-  Position pos;
-  string token, cmd;
-  StateListPtr states(new std::deque<StateInfo>(1));
-
-  pos.set(StartFEN, false, &states->back(), Threads.main());
+  string cmd;
 
   for (int i = 1; i < argc; ++i)
       cmd += std::string(argv[i]) + " ";
@@ -243,52 +510,121 @@ void UCI::loop(int argc, char* argv[]) {
       if (argc == 1 && !getline(cin, cmd)) // Block here waiting for input or EOF
           cmd = "quit";
 
-      istringstream is(cmd);
-
-      token.clear(); // Avoid a stale if getline() returns empty or blank line
-      is >> skipws >> token;
-
-      if (    token == "quit"
-          ||  token == "stop")
-          Threads.stop = true;
-
-      // The GUI sends 'ponderhit' to tell us the user has played the expected move.
-      // So 'ponderhit' will be sent if we were told to ponder on the same move the
-      // user has played. We should continue searching but switch from pondering to
-      // normal search.
-      else if (token == "ponderhit")
-          Threads.main()->ponder = false; // Switch to normal search
-
-      else if (token == "uci")
-          sync_cout << "id name " << engine_info(true)
-                    << "\n"       << Options
-                    << "\nuciok"  << sync_endl;
-
-      else if (token == "setoption")  setoption(is);
-      else if (token == "go")         go(pos, is, states);
-      else if (token == "position")   position(pos, is, states);
-      else if (token == "ucinewgame") Search::clear();
-      else if (token == "isready")    sync_cout << "readyok" << sync_endl;
-
-      // Additional custom non-UCI commands, mainly for debugging.
-      // Do not use these commands during a search!
-      else if (token == "flip")     pos.flip();
-      else if (token == "bench")    bench(pos, is, states);
-      else if (token == "d")        sync_cout << pos << sync_endl;
-      else if (token == "eval")     trace_eval(pos);
-      else if (token == "compiler") sync_cout << compiler_info() << sync_endl;
-      else if (token == "export_net")
+  } while (execute(engine, cmd) && argc == 1); // Command line args are one-shot
+}
+
+
+/// UCI::execute() runs a single command on the engine and returns false if the
+/// command was 'quit'. In addition to the UCI ones, also some additional debug
+/// commands are supported.
+
+bool UCI::execute(Engine& engine, const string& cmd) {
+
+  string token;
+  istringstream is(cmd);
+
+  is >> skipws >> token;
+
+  // Commands waiting for the threads would only run once a 'go batch' is done,
+  // without reading 'stop' in the meantime. Refuse them until then.
+  if (   engine.threads.batching
+      && token != "quit" && token != "stop" && token != "isready" && token != "uci"
+      && token != "d"    && token != "compiler" && !token.empty() && token[0] != '#')
+  {
+      engine.out << IO_LOCK << "info string " << token << " refused while go batch is running,"
+                               " send stop first" << sync_endl;
+      return true;
+  }
+
+  // ucinewgame resets the thread data in jobs running on the pool threads, main
+  // thread included. Wait for the resets before the commands using that data or
+  // the options, but not for the zeroing of the hash that follows them.
+  if (   token == "setoption" || token == "position"  || token == "flip"
+      || token == "eval"      || token == "evalbench" || token == "nnuestats"
+      || token == "ttstats")
+      engine.threads.wait_for_threads_cleared();
+
+  if (    token == "quit"
+      ||  token == "stop")
+      engine.threads.stop = true;
+
+  // The GUI sends 'ponderhit' to tell us the user has played the expected move.
+  // So 'ponderhit' will be sent if we were told to ponder on the same move the
+  // user has played. We should continue searching but switch from pondering to
+  // normal search.
+  else if (token == "ponderhit")
+      engine.threads.main()->ponder = false; // Switch to normal search
+
+  else if (token == "uci")
+      engine.out << IO_LOCK << "id name " << engine_info(true)
+                 << "\n"       << engine.options
+                 << "\nuciok"  << sync_endl;
+
+  else if (token == "setoption")  setoption(engine, is);
+  else if (token == "go")         go(engine, is);
+  else if (token == "position")   position(engine, is);
+  else if (token == "ucinewgame") Search::clear(engine);
+  else if (token == "isready")    engine.out << IO_LOCK << "readyok" << sync_endl;
+
+  // Additional custom non-UCI commands, mainly for debugging.
+  // Do not use these commands during a search!
+  else if (token == "flip")     engine.pos.flip();
+  else if (token == "bench")    bench(engine, is);
+  else if (token == "evalbench") evalbench(engine, is);
+  else if (token == "threadbench") threadbench(engine, is);
+  else if (token == "d")        engine.out << IO_LOCK << engine.pos << sync_endl;
+  else if (token == "eval")
+  {
+      string f;
+      if (is >> skipws >> token && token == "batch" && is >> f)
+          eval_batch(engine, f);
+      else
+          trace_eval(engine);
+  }
+  else if (token == "compiler") engine.out << IO_LOCK << compiler_info() << sync_endl;
+  else if (token == "ttstats")  engine.out << IO_LOCK << engine.tt.stats() << sync_endl;
+  else if (token == "nnuestats") engine.out << IO_LOCK << Eval::NNUE::stats(engine) << sync_endl;
+  else if (token == "export_net")
+  {
+      std::optional<std::string> filename;
+      std::string f;
+      if (is >> skipws >> f && f == "mapped")
       {
-          std::optional<std::string> filename;
-          std::string f;
-          if (is >> skipws >> f)
+          if (is >> f)
+              Eval::NNUE::save_eval_mapped(f, engine.out);
+          else
+              engine.out << IO_LOCK << "Failed to export a net. A mapped net can only be saved if the filename is specified" << sync_endl;
+      }
+      else
+      {
+          bool compressed = false;
+          if (f == "compressed")
+          {
+              compressed = true;
+              f.clear();
+              is >> f;
+          }
+          if (!f.empty())
               filename = f;
-          Eval::NNUE::save_eval(filename);
+          Eval::NNUE::save_eval(filename, engine.out, compressed);
       }
-      else if (!token.empty() && token[0] != '#')
-          sync_cout << "Unknown command: " << cmd << sync_endl;
+  }
+  else if (token == "tt")
+  {
+      string action, f;
+      is >> skipws >> action >> f;
+
+      if (action == "save" && !f.empty())
+          engine.tt.save(f);
+      else if (action == "load" && !f.empty())
+          engine.tt.load(f);
+      else
+          engine.out << IO_LOCK << "Usage: tt save|load <file>" << sync_endl;
+  }
+  else if (!token.empty() && token[0] != '#')
+      engine.out << IO_LOCK << "Unknown command: " << cmd << sync_endl;
 
-  } while (token != "quit" && argc == 1); // Command line args are one-shot
+  return token != "quit";
 }
 
 
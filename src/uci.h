@@ -19,6 +19,7 @@
 #ifndef UCI_H_INCLUDED
 #define UCI_H_INCLUDED
 
+#include <functional>
 #include <map>
 #include <string>
 
@@ -26,6 +27,7 @@
 
 namespace Stockfish {
 
+class Engine;
 class Position;
 
 namespace UCI {
@@ -43,7 +45,7 @@ typedef std::map<std::string, Option, CaseInsensitiveLess> OptionsMap;
 /// Option class implements an option as defined by UCI protocol
 class Option {
 
-  typedef void (*OnChange)(const Option&);
+  typedef std::function<void(const Option&)> OnChange;
 
 public:
   Option(OnChange = nullptr);
@@ -67,8 +69,10 @@ private:
   OnChange on_change;
 };
 
-void init(OptionsMap&);
-void loop(int argc, char* argv[]);
+void init(Engine& engine);
+bool is_shared(const std::string& name);
+void loop(Engine& engine, int argc, char* argv[]);
+bool execute(Engine& engine, const std::string& cmd);
 std::string value(Value v);
 std::string square(Square s);
 std::string move(Move m, bool chess960);
@@ -78,8 +82,6 @@ Move to_move(const Position& pos, std::string& str);
 
 } // namespace UCI
 
-extern UCI::OptionsMap Options;
-
 } // namespace Stockfish
 
 #endif // #ifndef UCI_H_INCLUDED
@@ -17,10 +17,14 @@
 */
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <ostream>
+#include <set>
 #include <sstream>
+#include <vector>
 
+#include "engine.h"
 #include "evaluate.h"
 #include "misc.h"
 #include "search.h"
@@ -33,19 +37,8 @@ using std::string;
 
 namespace Stockfish {
 
-UCI::OptionsMap Options; // Global object
-
 namespace UCI {
 
-/// 'On change' actions, triggered by an option's value change
-void on_clear_hash(const Option&) { Search::clear(); }
-void on_hash_size(const Option& o) { TT.resize(size_t(o)); }
-void on_logger(const Option& o) { start_logger(o); }
-void on_threads(const Option& o) { Threads.set(size_t(o)); }
-void on_tb_path(const Option& o) { Tablebases::init(o); }
-void on_use_NNUE(const Option& ) { Eval::NNUE::init(); }
-void on_eval_file(const Option& ) { Eval::NNUE::init(); }
-
 /// Our case insensitive less() function as required by UCI protocol
 bool CaseInsensitiveLess::operator() (const string& s1, const string& s2) const {
 
@@ -54,16 +47,58 @@ bool CaseInsensitiveLess::operator() (const string& s1, const string& s2) const
 }
 
 
-/// UCI::init() initializes the UCI options to their hard-coded default values
+/// UCI::is_shared() returns true for the options that rebuild data shared by
+/// all the engines of the process. They can only be changed by a lone engine,
+/// see Engine::set_shared_option().
+
+bool is_shared(const string& name) {
+
+  static const std::set<string, CaseInsensitiveLess> Shared = {
+      "Huge Pages", "SyzygyPath", "Use NNUE", "EvalFile" };
+
+  return Shared.count(name);
+}
+
+
+/// UCI::init() initializes the UCI options of the engine to their hard-coded
+/// default values. The 'on change' actions act on the engine that owns the
+/// options, except those of Debug Log File, Huge Pages, SyzygyPath, Use NNUE
+/// and EvalFile, that set data shared by all the engines of the process. An
+/// engine created next to others starts with the net they use.
 
-void init(OptionsMap& o) {
+void init(Engine& engine) {
 
   constexpr int MaxHashMB = Is64Bit ? 33554432 : 2048;
+  const bool alone = Engine::count() == 1;
+
+  OptionsMap& o = engine.options;
+
+  // 'On change' actions, triggered by an option's value change
+  auto on_clear_hash  = [&engine](const Option&) { Search::clear(engine); };
+  auto on_hash_size   = [&engine](const Option& v) { engine.tt.resize(size_t(v)); };
+  auto on_shared_hash = [&engine](const Option&) { engine.tt.resize(size_t(engine.options["Hash"])); };
+  auto on_huge_pages  = [&engine](const Option& v) {
+      set_huge_page_size(v == "1GB" ? size_t(1) << 30 : v == "2MB" ? size_t(1) << 21 : 0);
+      engine.tt.resize(size_t(engine.options["Hash"]));
+      Eval::eval_file_loaded = "None"; // Force reloading the net into new memory
+      Eval::NNUE::init(engine);
+  };
+  auto on_logger      = [](const Option& v) { start_logger(v); };
+  auto on_threads     = [&engine](const Option& v) { engine.threads.set(size_t(v)); };
+  auto on_tb_path     = [&engine](const Option& v) { if (Engine::count() == 1) Tablebases::init(v, engine.out); };
+  auto on_eval        = [&engine](const Option&) { Eval::NNUE::init(engine); };
+  auto on_eval_cache  = [&engine](const Option& v) {
+      engine.threads.run_job([&engine, mbSize = size_t(v)](size_t idx) {
+          engine.threads[idx]->evalCache.resize(mbSize);
+      });
+  };
 
   o["Debug Log File"]        << Option("", on_logger);
   o["Threads"]               << Option(1, 1, 512, on_threads);
   o["Hash"]                  << Option(16, 1, MaxHashMB, on_hash_size);
   o["Clear Hash"]            << Option(on_clear_hash);
+  o["Shared Hash"]           << Option("<empty>", on_shared_hash);
+  o["Huge Pages"]            << Option("Transparent var Transparent var 2MB var 1GB", "Transparent", on_huge_pages);
   o["Ponder"]                << Option(false);
   o["MultiPV"]               << Option(1, 1, 500);
   o["Skill Level"]           << Option(20, 0, 20);
@@ -79,8 +114,12 @@ void init(OptionsMap& o) {
   o["SyzygyProbeDepth"]      << Option(1, 1, 100);
   o["Syzygy50MoveRule"]      << Option(true);
   o["SyzygyProbeLimit"]      << Option(7, 0, 7);
-  o["Use NNUE"]              << Option(true, on_use_NNUE);
-  o["EvalFile"]              << Option(EvalFileDefaultName, on_eval_file);
+  o["Use NNUE"]              << Option(alone || Eval::useNNUE, on_eval);
+  o["EvalFile"]              << Option(alone ? EvalFileDefaultName : Eval::eval_file_loaded.c_str(), on_eval);
+  o["Eval Cache"]            << Option(0, 0, 1024, on_eval_cache);
+  o["NNUE Prefetch"]         << Option(false);
+  o["NNUE PSQT Prescreen"]   << Option(false);
+  o["Perft Hash"]            << Option(0, 0, MaxHashMB);
 }
 
 
@@ -89,23 +128,27 @@ void init(OptionsMap& o) {
 
 std::ostream& operator<<(std::ostream& os, const OptionsMap& om) {
 
-  for (size_t idx = 0; idx < om.size(); ++idx)
-      for (const auto& it : om)
-          if (it.second.idx == idx)
-          {
-              const Option& o = it.second;
-              os << "\noption name " << it.first << " type " << o.type;
+  std::vector<OptionsMap::const_iterator> sorted;
+
+  for (auto it = om.begin(); it != om.end(); ++it)
+      sorted.push_back(it);
 
-              if (o.type == "string" || o.type == "check" || o.type == "combo")
-                  os << " default " << o.defaultValue;
+  std::sort(sorted.begin(), sorted.end(),
+            [](auto a, auto b) { return a->second.idx < b->second.idx; });
 
-              if (o.type == "spin")
-                  os << " default " << int(stof(o.defaultValue))
-                     << " min "     << o.min
-                     << " max "     << o.max;
+  for (const auto& it : sorted)
+  {
+      const Option& o = it->second;
+      os << "\noption name " << it->first << " type " << o.type;
+
+      if (o.type == "string" || o.type == "check" || o.type == "combo")
+          os << " default " << o.defaultValue;
 
-              break;
-          }
+      if (o.type == "spin")
+          os << " default " << int(stof(o.defaultValue))
+             << " min "     << o.min
+             << " max "     << o.max;
+  }
 
   return os;
 }
@@ -145,11 +188,13 @@ bool Option::operator==(const char* s) const {
 }
 
 
-/// operator<<() inits options and assigns idx in the correct printing order
+/// operator<<() inits options and assigns idx in the correct printing order.
+/// The counter is shared by the options of all the engines of the process, so
+/// the indices of an engine increase but do not start from zero.
 
 void Option::operator<<(const Option& o) {
 
-  static size_t insert_order = 0;
+  static std::atomic<size_t> insert_order = 0;
 
   *this = o;
   idx = insert_order++;
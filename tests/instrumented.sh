@@ -121,6 +121,15 @@ cat << EOF > syzygy.exp
  send "uci\n"
  send "setoption name SyzygyPath value ../tests/syzygy/\n"
  expect "info string Found 35 tablebases" {} timeout {exit 1}
+
+ # The tablebase probes of 'd' must not touch the accumulators of the search
+ send "position fen 8/8/8/4k3/8/8/3KP3/8 w - - 0 1\n"
+ send "go infinite\n"
+ send "d\n"
+ expect "Tablebases WDL" {} timeout {exit 1}
+ send "stop\n"
+ expect "bestmove"
+
  send "bench 128 1 8 default depth\n"
  send "quit\n"
  expect eof
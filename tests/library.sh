@@ -0,0 +1,86 @@
+#!/bin/bash
+# build the static library and run two engines at the same time from a small
+# C program, checking that each one gets its own output, that an engine without
+# callback prints nothing and that an option shared by the engines cannot be
+# changed while the other one is searching.
+# Run from the src directory: ../tests/library.sh [ARCH]
+
+error()
+{
+  echo "library testing failed on line $1"
+  exit 1
+}
+trap 'error ${LINENO}' ERR
+
+arch=${1:-x86-64-modern}
+
+echo "library testing started (ARCH=$arch)"
+
+dir=`mktemp -d`
+cp -r . $dir
+make -C $dir clean > /dev/null
+make -C $dir -j2 ARCH=$arch library > /dev/null
+
+cat << EOF > $dir/library_test.c
+#include <stdio.h>
+#include <string.h>
+#include "libstockfish.h"
+
+static int perft, bestmoves, refused;
+
+static void on_perft(const char* line, void* data) {
+  if (!strcmp(line, "Nodes searched: 197281"))
+      perft++;
+  if (!strncmp(line, "info string EvalFile is shared", 30))
+      refused++;
+  if (!strncmp(line, "bestmove", 8))
+      bestmoves += 100; /* Output of the other engine */
+}
+
+static void on_search(const char* line, void* data) {
+  if (!strncmp(line, "Nodes searched", 14))
+      perft += 100; /* Output of the other engine */
+  if (!strncmp(line, "bestmove", 8))
+      bestmoves++;
+}
+
+int main(int argc, char* argv[]) {
+
+  sf_init(argc, argv);
+
+  sf_engine* a = sf_engine_new(on_perft, NULL);
+  sf_engine* b = sf_engine_new(on_search, NULL);
+
+  sf_engine_command(a, "setoption name Hash value 32");
+  sf_engine_command(b, "setoption name Threads value 2");
+  sf_engine_command(b, "position fen r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq -");
+  sf_engine_command(b, "go depth 12");
+  sf_engine_command(a, "setoption name EvalFile value nn-none.nnue"); /* Net in use by b */
+  sf_engine_command(a, "go perft 4");
+  sf_engine_wait(a);
+  sf_engine_wait(b);
+
+  sf_engine_delete(a);
+  sf_engine_delete(b);
+
+  /* An engine without callback runs silently, reports of options included */
+  sf_engine* c = sf_engine_new(NULL, NULL);
+  sf_engine_command(c, "setoption name Huge Pages value 2MB");
+  sf_engine_command(c, "setoption name SyzygyPath value .");
+  sf_engine_command(c, "go depth 5");
+  sf_engine_wait(c);
+  sf_engine_delete(c);
+
+  printf("perft %d bestmoves %d refused %d\n", perft, bestmoves, refused);
+  return perft != 1 || bestmoves != 1 || refused != 1;
+}
+EOF
+
+gcc -c -I$dir -o $dir/library_test.o $dir/library_test.c
+g++ -o $dir/library_test $dir/library_test.o $dir/libstockfish.a -lpthread
+out=`$dir/library_test`
+[ "$out" = "perft 1 bestmoves 1 refused 1" ]
+
+rm -rf $dir
+
+echo "library testing OK"
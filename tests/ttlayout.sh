@@ -0,0 +1,40 @@
+#!/bin/bash
+# compare the transposition table layouts selected with ttcluster=32/64 on the
+# bench positions: hit rate, nodes/second and time to reach the bench depth.
+# Run from the src directory: ../tests/ttlayout.sh [ARCH] [hash] [depth] [threads]
+
+error()
+{
+  echo "tt layout comparison failed on line $1"
+  exit 1
+}
+trap 'error ${LINENO}' ERR
+
+arch=${1:-x86-64-modern}
+hash=${2:-16}
+depth=${3:-13}
+threads=${4:-1}
+
+echo "tt layout comparison started (bench $hash $threads $depth, ARCH=$arch)"
+
+printf "%-10s %12s %10s %14s %10s\n" "cluster" "nodes" "hit rate" "nodes/second" "time (ms)"
+
+for cluster in 32 64; do
+  dir=`mktemp -d`
+  cp -r . $dir
+  make -C $dir clean > /dev/null
+  make -C $dir -j2 ARCH=$arch ttcluster=$cluster ttstats=yes build > /dev/null
+
+  $dir/stockfish bench $hash $threads $depth > $dir/ttlayout.txt 2>&1
+
+  nodes=`grep "Nodes searched  : " $dir/ttlayout.txt | awk '{print $4}'`
+  hits=`grep "Hits              : " $dir/ttlayout.txt | sed 's/.*(\(.*\))/\1/'`
+  nps=`grep "Nodes/second    : " $dir/ttlayout.txt | awk '{print $3}'`
+  time=`grep "Total time (ms) : " $dir/ttlayout.txt | awk '{print $5}'`
+
+  printf "%-10s %12s %10s %14s %10s\n" "$cluster bytes" "$nodes" "$hits" "$nps" "$time"
+
+  rm -rf $dir
+done
+
+echo "tt layout comparison OK"
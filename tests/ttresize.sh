@@ -0,0 +1,49 @@
+#!/bin/bash
+# verify that the entries of the transposition table survive a change of Hash,
+# when shrinking as when growing the table, by searching a position again after
+# the resize and comparing with a search from an empty table of the new size.
+# Run from the src directory: ../tests/ttresize.sh
+
+error()
+{
+  echo "ttresize testing failed on line $1"
+  exit 1
+}
+trap 'error ${LINENO}' ERR
+
+echo "ttresize testing started"
+
+fen="r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10"
+
+# nodes of the second search of the position, after setting Hash from $1 to $2,
+# or clearing the table if $2 is 'clear'. setoption waits for the search to end.
+second_search()
+{
+  if [ "$2" = "clear" ]; then change="setoption name Clear Hash"
+  else change="setoption name Hash value $2"; fi
+
+  printf "setoption name Use NNUE value false\nsetoption name Hash value $1\nposition fen $fen\ngo depth 13\n$change\ngo depth 13\nsetoption name Ponder value false\nquit\n" \
+    | ./stockfish 2>&1 | grep "^info depth 13 " | tail -1 | sed 's/.* nodes \([0-9]*\) .*/\1/'
+}
+
+for sizes in "16 16" "32 16" "48 16" "16 32" "16 48" "8 64"; do
+  set -- $sizes
+  cleared=`second_search $2 clear`
+  nodes=`second_search $1 $2`
+  echo "Hash $1 -> $2: $nodes nodes, $cleared from an empty table"
+  [ $((2 * nodes)) -lt $cleared ]
+done
+
+# a snapshot is rehashed into a table of another size, larger or smaller
+for sizes in "8 32" "32 8"; do
+  set -- $sizes
+  cleared=`second_search $2 clear`
+  nodes=`printf "setoption name Use NNUE value false\nsetoption name Hash value $1\nposition fen $fen\ngo depth 13\ntt save ttresize.tt\nsetoption name Clear Hash\nsetoption name Hash value $2\ntt load ttresize.tt\ngo depth 13\nsetoption name Ponder value false\nquit\n" \
+    | ./stockfish 2>&1 | grep "^info depth 13 " | tail -1 | sed 's/.* nodes \([0-9]*\) .*/\1/'`
+  echo "Snapshot of Hash $1 loaded with Hash $2: $nodes nodes, $cleared from an empty table"
+  [ $((2 * nodes)) -lt $cleared ]
+done
+
+rm -f ttresize.tt
+
+echo "ttresize testing OK"